@@ -0,0 +1,163 @@
+/*
+ * bintrace.c - Compact binary trace files
+ *
+ * See bintrace.h for the format.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bintrace.h"
+
+/*
+ * get_varint - Decodes the varint at *pp, advancing *pp past it.
+ *     Returns 0 if it runs past end or does not fit in an unsigned long.
+ */
+static int get_varint(unsigned char **pp, unsigned char *end, 
+		      unsigned long *value)
+{
+    unsigned char *p = *pp;
+    unsigned long v = 0;
+    int shift;
+
+    for (shift = 0; p < end && shift < 64; shift += 7) {
+	v |= (unsigned long)(*p & 0x7f) << shift;
+	if ((*p++ & 0x80) == 0) {
+	    *pp = p;
+	    *value = v;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/*
+ * put_varint - Appends value to fp as a varint
+ */
+static void put_varint(FILE *fp, unsigned long value)
+{
+    while (value >= 0x80) {
+	putc((int)(value & 0x7f) | 0x80, fp);
+	value >>= 7;
+    }
+    putc((int)value, fp);
+}
+
+/*
+ * bt_open - Maps the binary trace at path and reads its header
+ */
+int bt_open(char *path, bintrace_t *bt)
+{
+    unsigned long fields[4];
+    struct stat st;
+    int fd, i;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return -1;
+    if (fstat(fd, &st) < 0) {
+	close(fd);
+	return -1;
+    }
+    if (st.st_size < BT_MAGIC_LEN) {
+	close(fd);
+	return 0;
+    }
+
+    bt->len = st.st_size;
+    bt->base = mmap(NULL, bt->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (bt->base == MAP_FAILED)
+	return -1;
+    if (memcmp(bt->base, BT_MAGIC, BT_MAGIC_LEN) != 0) {
+	munmap(bt->base, bt->len);
+	return 0;
+    }
+
+    /* Requests are only read front to back */
+    madvise(bt->base, bt->len, MADV_SEQUENTIAL);
+
+    bt->start = bt->base + BT_MAGIC_LEN;
+    for (i = 0; i < 4; i++)
+	if (!get_varint(&bt->start, bt->base + bt->len, &fields[i]) ||
+	    fields[i] > 0x7fffffff) {
+	    munmap(bt->base, bt->len);
+	    errno = EINVAL;
+	    return -1;
+	}
+    bt->sugg_heapsize = (int)fields[0];
+    bt->num_ids = (int)fields[1];
+    bt->num_ops = (int)fields[2];
+    bt->weight = (int)fields[3];
+    bt_rewind(bt);
+    return 1;
+}
+
+/*
+ * bt_rewind - Makes the next bt_next return the first request again
+ */
+void bt_rewind(bintrace_t *bt)
+{
+    bt->cur = bt->start;
+    bt->left = bt->num_ops;
+}
+
+/*
+ * bt_next - Decodes the next request. Returns 1 if there was one, 
+ *     0 after the last one, and -1 if the file is truncated or corrupt.
+ *     size is left alone for a free.
+ */
+int bt_next(bintrace_t *bt, int *type, unsigned *index, unsigned *size)
+{
+    unsigned char *end = bt->base + bt->len;
+    unsigned long op, bytes;
+
+    if (bt->left == 0)
+	return 0;
+    if (!get_varint(&bt->cur, end, &op) || (op & 3) > BT_REALLOC ||
+	(op >> 2) > 0xffffffffUL)
+	return -1;
+    *type = (int)(op & 3);
+    *index = (unsigned)(op >> 2);
+    if (*type != BT_FREE) {
+	if (!get_varint(&bt->cur, end, &bytes) || bytes > 0xffffffffUL)
+	    return -1;
+	*size = (unsigned)bytes;
+    }
+    bt->left--;
+    return 1;
+}
+
+/*
+ * bt_close - Unmaps a binary trace
+ */
+void bt_close(bintrace_t *bt)
+{
+    munmap(bt->base, bt->len);
+}
+
+/*
+ * bt_put_header - Starts a binary trace on fp
+ */
+void bt_put_header(FILE *fp, int sugg_heapsize, int num_ids, int num_ops, 
+		   int weight)
+{
+    fwrite(BT_MAGIC, 1, BT_MAGIC_LEN, fp);
+    put_varint(fp, sugg_heapsize);
+    put_varint(fp, num_ids);
+    put_varint(fp, num_ops);
+    put_varint(fp, weight);
+}
+
+/*
+ * bt_put_op - Appends one request to a binary trace on fp
+ */
+void bt_put_op(FILE *fp, int type, unsigned index, unsigned size)
+{
+    put_varint(fp, ((unsigned long)index << 2) | type);
+    if (type != BT_FREE)
+	put_varint(fp, size);
+}
@@ -0,0 +1,52 @@
+/*
+ * bintrace.h - Compact binary trace files
+ *
+ * A binary trace holds the same requests as a .rep file. It starts
+ * with the 8 bytes of BT_MAGIC, followed by the four header fields of
+ * a .rep file (suggested heap size, number of ids, number of requests
+ * and weight). Then come the requests, in order. Every number is an
+ * unsigned LEB128 varint. A request is (index << 2 | type), followed
+ * by the byte size unless it is a free.
+ *
+ * Readers map the file and decode one request at a time, so replaying
+ * a trace never needs all of its requests in memory at once.
+ */
+#ifndef __BINTRACE_H_
+#define __BINTRACE_H_
+
+#include <stdio.h>
+
+#define BT_MAGIC     "mmtrace1"
+#define BT_MAGIC_LEN 8
+
+/* Request types, numbered as in mdriver's traceop_t */
+#define BT_ALLOC   0
+#define BT_FREE    1
+#define BT_REALLOC 2
+
+/* An open binary trace */
+typedef struct {
+    unsigned char *base;    /* the mapped file... */
+    size_t len;             /* ... and its length */
+    unsigned char *start;   /* first request */
+    unsigned char *cur;     /* next request to decode */
+    unsigned long left;     /* requests not yet decoded */
+    int sugg_heapsize;      /* header fields, as in a .rep file */
+    int num_ids;
+    int num_ops;
+    int weight;
+} bintrace_t;
+
+/* Reading: bt_open returns 1 on success, 0 if path is not a binary
+   trace, and -1 with errno set if it could not be read */
+int bt_open(char *path, bintrace_t *bt);
+void bt_rewind(bintrace_t *bt);
+int bt_next(bintrace_t *bt, int *type, unsigned *index, unsigned *size);
+void bt_close(bintrace_t *bt);
+
+/* Writing */
+void bt_put_header(FILE *fp, int sugg_heapsize, int num_ids, int num_ops, 
+		   int weight);
+void bt_put_op(FILE *fp, int type, unsigned index, unsigned size);
+
+#endif /* __BINTRACE_H_ */
@@ -53,14 +53,38 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes (4, 8 or 16) 
  */
-#define ALIGNMENT 8  
+#define ALIGNMENT 16 
+
+/*
+ * The heap is always a range of virtual memory reserved with mmap. Set
+ * MEM_USE_MMAP to 1 to manage its pages as a real allocator must:
+ * they are reserved inaccessible and committed as each brk grows,
+ * decommitted when a brk shrinks, and mem_discard hands the inside of
+ * large free blocks back to the OS. Each region also gets the larger
+ * MAX_HEAP below. Left at 0, the reservation is readable and writable
+ * from the start, memory is never given back, and mm.c skips trimming.
+ */
+#ifndef MEM_USE_MMAP
+#define MEM_USE_MMAP 0
+#endif
+
+/*
+ * Number of independent heap regions memlib hands out, side by side in
+ * one reservation; mm.c runs one arena per region
+ */
+#define MEM_REGIONS 32
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes of each region (MEM_REGIONS of them must
+ * fit in 4 GB, see mm.c)
  */
+#if MEM_USE_MMAP
+#define MAX_HEAP (1UL<<27)     /* 128 MB of reserved address space */
+#else
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#endif
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
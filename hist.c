@@ -0,0 +1,96 @@
+/*
+ * hist.c - Log-bucketed histograms for recording latencies
+ *
+ * Bucket b < HIST_SUB_COUNT holds exactly the value b. Above that, a
+ * value v with its top bit at position e lands in octave 
+ * e - HIST_SUB_BITS + 1, in the sub-bucket given by the HIST_SUB_BITS
+ * bits just below the top one.
+ */
+#include <string.h>
+#include "hist.h"
+
+/*
+ * bucket_of - Returns the bucket that value falls in
+ */
+static int bucket_of(unsigned long value)
+{
+    int e;
+
+    if (value < HIST_SUB_COUNT)
+	return (int)value;
+    e = 63 - __builtin_clzl(value);
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) |
+	(int)((value >> (e - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1));
+}
+
+/*
+ * bucket_high - Returns the largest value that falls in bucket b
+ */
+static unsigned long bucket_high(int b)
+{
+    int shift;
+
+    if (b < HIST_SUB_COUNT)
+	return (unsigned long)b;
+    shift = (b >> HIST_SUB_BITS) - 1;
+    return (((unsigned long)(HIST_SUB_COUNT | (b & (HIST_SUB_COUNT - 1))) 
+	     + 1) << shift) - 1;
+}
+
+/* 
+ * hist_reset - Empties a histogram
+ */
+void hist_reset(hist_t *h)
+{
+    memset(h, 0, sizeof(hist_t));
+}
+
+/* 
+ * hist_record - Counts one value
+ */
+void hist_record(hist_t *h, unsigned long value)
+{
+    h->counts[bucket_of(value)]++;
+    h->count++;
+    if (value > h->max)
+	h->max = value;
+}
+
+/* 
+ * hist_merge - Adds every value counted in src to dst
+ */
+void hist_merge(hist_t *dst, hist_t *src)
+{
+    int b;
+
+    for (b = 0; b < HIST_BUCKETS; b++)
+	dst->counts[b] += src->counts[b];
+    dst->count += src->count;
+    if (src->max > dst->max)
+	dst->max = src->max;
+}
+
+/*
+ * hist_percentile - Returns a value at least as large as pct percent
+ *     of the recorded values (the top of the bucket the percentile 
+ *     falls in, but never more than the largest value seen). Returns 
+ *     0 for an empty histogram.
+ */
+unsigned long hist_percentile(hist_t *h, double pct)
+{
+    unsigned long rank, seen = 0, high;
+    int b;
+
+    if (h->count == 0)
+	return 0;
+    rank = (unsigned long)(pct / 100.0 * h->count + 0.5);
+    if (rank < 1)
+	rank = 1;
+    for (b = 0; b < HIST_BUCKETS; b++) {
+	seen += h->counts[b];
+	if (seen >= rank)
+	    break;
+    }
+    high = bucket_high(b);
+    return high < h->max ? high : h->max;
+}
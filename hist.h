@@ -0,0 +1,27 @@
+/*
+ * hist.h - Log-bucketed histograms for recording latencies
+ *
+ * Values are counted in buckets whose width grows with the value:
+ * each power of two is split into HIST_SUB_COUNT equal sub-buckets,
+ * so a percentile read back from a histogram is within 1/HIST_SUB_COUNT
+ * of the value that was recorded, whatever its magnitude.
+ */
+#ifndef __HIST_H_
+#define __HIST_H_
+
+#define HIST_SUB_BITS  4                     /* log2 of sub-buckets */
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)  /* sub-buckets per octave */
+#define HIST_BUCKETS   ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct {
+    unsigned long counts[HIST_BUCKETS]; /* number of values per bucket */
+    unsigned long count;                /* number of values recorded */
+    unsigned long max;                  /* largest value recorded */
+} hist_t;
+
+void hist_reset(hist_t *h);
+void hist_record(hist_t *h, unsigned long value);
+void hist_merge(hist_t *dst, hist_t *src);
+unsigned long hist_percentile(hist_t *h, double pct);
+
+#endif /* __HIST_H_ */
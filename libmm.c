@@ -0,0 +1,129 @@
+/*
+ * libmm.c - The malloc package as a drop-in replacement for the system malloc.
+ *
+ * Built into libmm.so (make libmm.so) together with mm.c and memlib.c, on a heap backed by mmap, it
+ * exports the standard allocation functions so that it can be linked into a program or loaded into one
+ * with LD_PRELOAD. The heap is set up by whichever call comes first, from any thread; fork handlers keep
+ * the package usable in a child.
+ *
+ * Where the standard and the package differ, the standard wins: malloc(0) returns a unique pointer rather
+ * than NULL, failures set errno to ENOMEM, and invalid alignments are rejected with EINVAL.
+ */
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mm.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static int ready;           /*set once the heap is up, checked before paying for pthread_once*/
+
+static void initHeap(void)
+{
+    mm_init();
+    pthread_atfork(mm_fork_prepare, mm_fork_parent, mm_fork_child);
+    __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+}
+
+static void ensureHeap(void)
+{
+    if (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE))
+        pthread_once(&init_once, initHeap);
+}
+
+/*errno is only touched on failure, as the standard asks*/
+static void* checked(void* ptr)
+{
+    if (ptr == NULL)
+        errno = ENOMEM;
+    return ptr;
+}
+
+EXPORT void* malloc(size_t size)
+{
+    ensureHeap();
+    return checked(mm_malloc(size == 0 ? 1 : size));
+}
+
+EXPORT void free(void* ptr)
+{
+    if (ptr != NULL)
+        mm_free(ptr);
+}
+
+EXPORT void* calloc(size_t nmemb, size_t size)
+{
+    size_t bytes;
+    if (__builtin_mul_overflow(nmemb, size, &bytes))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    /*mm_malloc rather than malloc: the compiler folds malloc+memset into a call to calloc, i.e. into this*/
+    ensureHeap();
+    void* ptr = checked(mm_malloc(bytes == 0 ? 1 : bytes));
+    if (ptr != NULL)
+        memset(ptr, 0, bytes);
+    return ptr;
+}
+
+EXPORT void* realloc(void* ptr, size_t size)
+{
+    ensureHeap();
+    if (ptr != NULL && size == 0)
+    {
+        mm_free(ptr);
+        return NULL;
+    }
+    return checked(mm_realloc(ptr, size == 0 ? 1 : size));
+}
+
+/*alignment must be a power of two and a multiple of sizeof(void*)*/
+EXPORT int posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    ensureHeap();
+    void* ptr = mm_memalign(alignment, size == 0 ? 1 : size);
+    if (ptr == NULL)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+EXPORT void* aligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    ensureHeap();
+    return checked(mm_memalign(alignment, size == 0 ? 1 : size));
+}
+
+/*the obsolete aligned allocators: a program that calls them frees the result with our free*/
+EXPORT void* memalign(size_t alignment, size_t size)
+{
+    return aligned_alloc(alignment, size);
+}
+
+EXPORT void* valloc(size_t size)
+{
+    return aligned_alloc((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+EXPORT void* pvalloc(size_t size)
+{
+    size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    return aligned_alloc(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+EXPORT size_t malloc_usable_size(void* ptr)
+{
+    return mm_usable_size(ptr);
+}
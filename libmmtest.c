@@ -0,0 +1,184 @@
+/*
+ * libmmtest.c - Checks that libmm.so serves a program past one arena
+ *
+ * Build and run it with "make test", which runs it as
+ *
+ *     unix> LD_PRELOAD=./libmm.so ./libmmtest
+ *
+ * A thread allocates from the arena of one memlib region, and that
+ * region holds MAX_HEAP (128 MB) of heap. Each phase below has one or
+ * more threads allocate TEST_BYTES or more in blocks of one size,
+ * through slab runs, thread caches, the arena itself and realloc.
+ * The phases pass only if every allocation succeeds and every block
+ * still holds the pattern written into it, so they also fail on
+ * blocks handed out twice. Each phase then frees all of its blocks,
+ * and fails if more than RSS_LEFT of the process is still resident:
+ * the memory of the regions a thread spilled into must be given back
+ * too, not only that of its own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define TEST_BYTES   (320UL << 20)  /* well past one region's 128 MB */
+#define TEST_THREADS 4              /* threads of the threaded phase... */
+#define THREAD_BYTES (96UL << 20)   /* ... each allocating this much */
+#define RSS_LEFT     (16UL << 20)   /* most left resident after a phase */
+
+/* One thread's share of a phase */
+typedef struct {
+    size_t size;       /* bytes of each block */
+    size_t grow;       /* if not 0, realloc each block to this many bytes */
+    size_t bytes;      /* bytes to allocate in all */
+    int id;            /* written into the blocks, with their index */
+    const char *fail;  /* NULL, or what went wrong */
+} job_t;
+
+/* Holds every thread of a phase until all have allocated their blocks */
+static pthread_barrier_t allocated;
+
+/*
+ * fill - Writes the pattern of block i of job into its first and last
+ *     word, which is enough to catch blocks that overlap
+ */
+static void fill(job_t *job, char *p, size_t n, size_t i)
+{
+    size_t tag = i * 64 + job->id;
+
+    memcpy(p, &tag, sizeof tag);
+    memcpy(p + n - sizeof tag, &tag, sizeof tag);
+}
+
+/*
+ * holds - Checks the pattern fill wrote into block i, n bytes long
+ */
+static int holds(job_t *job, char *p, size_t n, size_t i)
+{
+    size_t tag = i * 64 + job->id, head, tail;
+
+    memcpy(&head, p, sizeof head);
+    memcpy(&tail, p + n - sizeof tail, sizeof tail);
+    return head == tag && tail == tag;
+}
+
+/*
+ * run_job - Allocates, checks and frees the blocks of one job. The
+ *     blocks are only checked once every job of the phase holds all
+ *     of its own, so the threads need their memory at the same time.
+ */
+static void *run_job(void *arg)
+{
+    job_t *job = arg;
+    size_t n = job->bytes / (job->grow ? job->grow : job->size);
+    size_t last = job->grow ? job->grow : job->size;
+    char **blocks = malloc(n * sizeof(char *));
+    size_t i;
+
+    if (blocks == NULL)
+	job->fail = "no room for the block table";
+    for (i = 0; i < n && job->fail == NULL; i++) {
+	if ((blocks[i] = malloc(job->size)) == NULL)
+	    job->fail = "malloc returned NULL";
+	else
+	    fill(job, blocks[i], job->size, i);
+    }
+    for (i = 0; job->grow && i < n && job->fail == NULL; i++) {
+	char *p = realloc(blocks[i], job->grow);
+
+	if (p == NULL)
+	    job->fail = "realloc returned NULL";
+	else if (!holds(job, p, job->size, i))  /* the old bytes moved along */
+	    job->fail = "realloc lost the payload";
+	else {
+	    fill(job, p, job->grow, i);
+	    blocks[i] = p;
+	}
+    }
+    pthread_barrier_wait(&allocated);
+    for (i = 0; i < n && job->fail == NULL; i++)
+	if (!holds(job, blocks[i], last, i))
+	    job->fail = "a block was overwritten";
+    if (job->fail == NULL)
+	for (i = 0; i < n; i++)
+	    free(blocks[i]);
+    free(blocks);
+    return NULL;
+}
+
+/*
+ * resident - Returns the bytes of the process resident in memory, or
+ *     0 if /proc/self/statm cannot be read
+ */
+static size_t resident(void)
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    unsigned long pages = 0;
+
+    if (f != NULL) {
+	if (fscanf(f, "%*u %lu", &pages) != 1)
+	    pages = 0;
+	fclose(f);
+    }
+    return pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * run_phase - Runs threads jobs of size-byte blocks at once, each job
+ *     allocating bytes. Returns 0 if all of them passed and the
+ *     memory they freed was given back.
+ */
+static int run_phase(const char *name, size_t size, size_t grow,
+		     size_t bytes, int threads)
+{
+    pthread_t tid[TEST_THREADS];
+    job_t jobs[TEST_THREADS];
+    int t, failed = 0;
+    size_t left;
+
+    for (t = 0; t < threads; t++) {
+	jobs[t].size = size;
+	jobs[t].grow = grow;
+	jobs[t].bytes = bytes;
+	jobs[t].id = t;
+	jobs[t].fail = NULL;
+    }
+    pthread_barrier_init(&allocated, NULL, threads);
+    for (t = 0; t < threads; t++) {
+	if (pthread_create(&tid[t], NULL, run_job, &jobs[t]) != 0) {
+	    printf("FAIL %s: cannot start thread %d\n", name, t);
+	    exit(1);
+	}
+    }
+    for (t = 0; t < threads; t++)
+	pthread_join(tid[t], NULL);
+    pthread_barrier_destroy(&allocated);
+    for (t = 0; t < threads; t++) {
+	if (jobs[t].fail != NULL) {
+	    printf("FAIL %s: thread %d: %s\n", name, t, jobs[t].fail);
+	    failed = 1;
+	}
+    }
+    if (failed)
+	return failed;
+    if ((left = resident()) > RSS_LEFT) {
+	printf("FAIL %s: %lu MB still resident after freeing everything\n",
+	       name, (unsigned long)(left >> 20));
+	return 1;
+    }
+    printf("ok   %s: %d x %lu MB, %lu MB left resident\n", name, threads,
+	   (unsigned long)(bytes >> 20), (unsigned long)(left >> 20));
+    return 0;
+}
+
+int main(void)
+{
+    /* A failed phase leaves its blocks allocated, so stop at the first */
+    return run_phase("slab objects", 64, 0, TEST_BYTES, 1) ||
+	run_phase("cached blocks", 384, 0, TEST_BYTES, 1) ||
+	run_phase("arena blocks", 1000, 0, TEST_BYTES, 1) ||
+	run_phase("large blocks", 20000, 0, TEST_BYTES, 1) ||
+	run_phase("realloc", 1000, 6000, TEST_BYTES, 1) ||
+	run_phase("threads", 1000, 0, THREAD_BYTES, TEST_THREADS);
+}
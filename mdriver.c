@@ -14,11 +14,17 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <stdint.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "mm.h"
+#include "mmregion.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "hist.h"
+#include "bintrace.h"
 #include "config.h"
 
 /**********************
@@ -29,9 +35,19 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define REPLAY_REPS    3 /* best-of runs for each concurrent replay (-T) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
+
+/* 
+ * Copies request i of trace into op for the timed replays, returning
+ * 0 past the last one. A text trace is read in place rather than
+ * through trace_next, so only binary traces pay for decoding requests.
+ */
+#define TIMED_NEXT(trace, i, op) ((trace)->ops == NULL ?                 \
+    trace_next((trace), &(op)) :                                          \
+    ((i) < (trace)->num_ops && ((op) = (trace)->ops[(i)], 1)))
 
 /****************************** 
  * The key compound data types 
@@ -41,7 +57,8 @@
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges with a lower lo */
+    struct range_t *right; /* ranges with a higher lo */
 } range_t;
 
 /* Characterizes a single trace operation (allocator request) */
@@ -57,7 +74,9 @@ typedef struct {
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
+    traceop_t *ops;      /* array of requests read from a .rep file... */
+    bintrace_t *bin;     /* ... or the mapped binary trace holding them */
+    int next_op;         /* next request trace_next returns from ops */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
 } trace_t;
@@ -70,6 +89,8 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    size_t chunks;   /* out: chunks of the last region replay (-r), 
+			0 if the heap could not hold the whole trace */
 } speed_t;
 
 /* Summarizes the important stats for some malloc function on some trace */
@@ -85,11 +106,45 @@ typedef struct {
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* Latency histograms of the mm package on one trace, one per request type */
+typedef struct {
+    hist_t op[3];    /* indexed by ALLOC, FREE, REALLOC (nanoseconds) */
+} latency_t;
+
+/* Holds the params and the result of one thread of a concurrent replay */
+typedef struct {
+    traceop_t *ops;            /* this thread's shard of the trace */
+    int num_ops;               /* number of requests in the shard */
+    char **blocks;             /* this thread's ptrs from malloc/realloc */
+    pthread_barrier_t *start;  /* lets every thread start at once */
+    double begin;              /* wall clock when this thread started... */
+    double end;                /* ... and when it was done */
+} replay_t;
+
+/* Summarizes a concurrent replay of one trace with -T threads */
+typedef struct {
+    double ops;      /* number of ops in the trace */
+    double secs1;    /* wall time to replay the trace on one thread */
+    double secs;     /* wall time to replay its shards on all threads */
+    double avg_lat;  /* mean per-op latency over the threads (secs) */
+    double max_lat;  /* per-op latency of the slowest thread (secs) */
+} thread_stats_t;
+
+/* Compares replaying a trace in a region with per-object frees (-r) */
+typedef struct {
+    double secs;       /* time to replay the trace in one region */
+    size_t heap;       /* peak heap size in the region replay... */
+    size_t heap_free;  /* ... and in a replay with per-object frees */
+    size_t chunks;     /* chunks the region took from mm_malloc, 0 if 
+			  the trace does not fit in the heap without frees */
+} region_stats_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int check_heap = 0; /* if set, run mm_check after every request (-c) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -105,7 +160,7 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
@@ -114,6 +169,8 @@ static void clear_ranges(range_t **ranges);
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
 static void free_trace(trace_t *trace);
+static void trace_rewind(trace_t *trace);
+static int trace_next(trace_t *trace, traceop_t *op);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -124,9 +181,28 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, latency_t *latency);
+static void eval_mm_heapstats(trace_t *trace, mm_stats_t *heap);
+static void eval_region_speed(void *ptr);
+static void eval_mm_region(speed_t *speed_params, region_stats_t *region);
+
+/* Routines for replaying a trace on several threads at once (-T) */
+static double wall_secs(void);
+static void *replay_thread(void *ptr);
+static void shard_trace(trace_t *trace, int nthreads, replay_t *replays);
+static double run_replay(int nthreads, replay_t *replays);
+static void eval_mm_threads(trace_t *trace, int nthreads, 
+			    thread_stats_t *stats);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printlatency(int n, stats_t *mm_stats, latency_t *latency);
+static void printheapstats(int n, stats_t *mm_stats, mm_stats_t *heap);
+static void printevents(int n, stats_t *mm_stats, mm_events_t *events);
+static void printregionresults(int n, stats_t *mm_stats, 
+			       region_stats_t *region);
+static void printthreadresults(int n, int nthreads, stats_t *mm_stats,
+			       thread_stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -150,6 +226,16 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int num_threads = 0; /* If set, replay each trace on this many threads (-T) */
+    int run_latency = 0; /* If set, time every request of mm malloc (-p) */
+    int run_heapstats = 0; /* If set, sample mm_stats at each peak (-s) */
+    int run_events = 0;  /* If set, print the event counts of mm.c (-e) */
+    int run_region = 0;  /* If set, also replay each trace in a region (-r) */
+    latency_t *latency = NULL; /* -p histograms for each trace */
+    mm_stats_t *heap_stats = NULL; /* -s heap statistics for each trace */
+    mm_events_t *events = NULL; /* -e event counts for each trace */
+    region_stats_t *region_stats = NULL; /* -r results for each trace */
+    thread_stats_t *thread_stats = NULL; /* -T stats for each trace */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +244,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:T:hvVgalpsecr")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,12 +264,34 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+	case 'T': /* Also replay each trace on this many threads at once */
+	    num_threads = atoi(optarg);
+	    if (num_threads < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'p': /* Print per-request latency percentiles for mm malloc */
+            run_latency = 1;
+            break;
+        case 's': /* Print heap statistics of mm malloc at each peak */
+            run_heapstats = 1;
+            break;
+        case 'e': /* Print the hot-path event counts of mm malloc */
+            run_events = 1;
+            break;
+        case 'c': /* Check the heap of mm malloc after every request */
+            check_heap = 1;
+            break;
+        case 'r': /* Also replay each trace in an mm_region_t */
+            run_region = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -284,6 +392,35 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
     
+    /* Allocate the latency histograms, one latency_t per tracefile */
+    if (run_latency) {
+	latency = (latency_t *)calloc(num_tracefiles, sizeof(latency_t));
+	if (latency == NULL)
+	    unix_error("latency calloc in main failed");
+    }
+
+    /* Allocate the heap statistics, one mm_stats_t per tracefile */
+    if (run_heapstats) {
+	heap_stats = (mm_stats_t *)calloc(num_tracefiles, sizeof(mm_stats_t));
+	if (heap_stats == NULL)
+	    unix_error("heap_stats calloc in main failed");
+    }
+
+    /* Allocate the event counts, one mm_events_t per tracefile */
+    if (run_events) {
+	events = (mm_events_t *)calloc(num_tracefiles, sizeof(mm_events_t));
+	if (events == NULL)
+	    unix_error("events calloc in main failed");
+    }
+
+    /* Allocate the region results, one region_stats_t per tracefile */
+    if (run_region) {
+	region_stats = (region_stats_t *)calloc(num_tracefiles, 
+						sizeof(region_stats_t));
+	if (region_stats == NULL)
+	    unix_error("region_stats calloc in main failed");
+    }
+
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
@@ -303,6 +440,15 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    /* mm_init resets the counts, so they cover the last timed replay */
+	    if (run_events && !mm_events(&events[i]) && i == 0)
+		printf("mm.c was built without MM_EVENTS, so -e counts nothing (make clean; make EVENTS=1)\n");
+	    if (run_latency)
+		eval_mm_latency(trace, &latency[i]);
+	    if (run_heapstats)
+		eval_mm_heapstats(trace, &heap_stats[i]);
+	    if (run_region)
+		eval_mm_region(&speed_params, &region_stats[i]);
 	}
 	free_trace(trace);
     }
@@ -314,6 +460,62 @@ int main(int argc, char **argv)
 	printf("\n");
     }
 
+    /* Display the tail latencies of each request type */
+    if (run_latency) {
+	printf("Request latency (ns) for mm malloc:\n");
+	printlatency(num_tracefiles, mm_stats, latency);
+	printf("\n");
+    }
+
+    /* Display what mm.c did to serve each trace */
+    if (run_events) {
+	printf("Events of mm malloc per replay of each trace:\n");
+	printevents(num_tracefiles, mm_stats, events);
+	printf("\n");
+    }
+
+    /* Display the state of the heap at the peak of each trace */
+    if (run_heapstats) {
+	printf("Heap statistics for mm malloc at the peak of each trace:\n");
+	printheapstats(num_tracefiles, mm_stats, heap_stats);
+	printf("\n");
+    }
+
+    /* Display what releasing whole regions saves over per-object frees */
+    if (run_region) {
+	printf("Region replay for mm malloc (frees dropped, one release "
+	       "per trace):\n");
+	printregionresults(num_tracefiles, mm_stats, region_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay every valid trace split across num_threads 
+     * threads, each thread owning the blocks of every num_threads-th id
+     */
+    if (num_threads > 0 && errors == 0) {
+	thread_stats = (thread_stats_t *)calloc(num_tracefiles, 
+						sizeof(thread_stats_t));
+	if (thread_stats == NULL)
+	    unix_error("thread_stats calloc in main failed");
+
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (verbose > 1)
+		printf("Replaying %s on %d thread(s)\n", tracefiles[i], 
+		       num_threads);
+	    eval_mm_threads(trace, num_threads, &thread_stats[i]);
+	    free_trace(trace);
+	}
+
+	printf("Results for mm malloc on %d threads:\n", num_threads);
+	printthreadresults(num_tracefiles, num_threads, mm_stats, 
+			   thread_stats);
+	printf("\n");
+    }
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -367,22 +569,83 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
+ *
+ * The tree is a treap ordered by lo: a binary search tree whose 
+ * nodes also form a heap on a priority hashed from lo, which keeps 
+ * it balanced in expectation. Since live payloads never overlap, 
+ * a new payload can only overlap its nearest neighbours in lo order.
  ****************************************************************/
 
+/*
+ * range_priority - The treap priority of a range
+ */
+static unsigned long range_priority(range_t *p)
+{
+    return (unsigned long)p->lo * 0x9E3779B97F4A7C15UL;
+}
+
+/*
+ * rotate_right, rotate_left - Lift the left (right) child of the
+ *     subtree at *link to its root
+ */
+static void rotate_right(range_t **link)
+{
+    range_t *root = *link;
+    range_t *pivot = root->left;
+
+    root->left = pivot->right;
+    pivot->right = root;
+    *link = pivot;
+}
+
+static void rotate_left(range_t **link)
+{
+    range_t *root = *link;
+    range_t *pivot = root->right;
+
+    root->right = pivot->left;
+    pivot->left = root;
+    *link = pivot;
+}
+
+/*
+ * insert_range - Insert node into the subtree at *link as a leaf,
+ *     then rotate it up past any lower priorities
+ */
+static void insert_range(range_t **link, range_t *node)
+{
+    range_t *root = *link;
+
+    if (root == NULL) {
+	node->left = node->right = NULL;
+	*link = node;
+    }
+    else if (node->lo < root->lo) {
+	insert_range(&root->left, node);
+	if (range_priority(root->left) > range_priority(root))
+	    rotate_right(link);
+    }
+    else {
+	insert_range(&root->right, node);
+	if (range_priority(root->right) > range_priority(root))
+	    rotate_left(link);
+    }
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *pred = NULL, *succ = NULL;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -395,36 +658,47 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or of a
+       chunk the package mapped for itself */
+    if (!mem_contains(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads, so neither the
+     * last one starting at or below lo nor the first one above it 
+     */
+    for (p = *ranges;  p != NULL; ) {
+	if (p->lo <= lo) {
+	    pred = p;
+	    p = p->right;
+	}
+	else {
+	    succ = p;
+	    p = p->left;
+	}
+    }
+    p = (pred != NULL && pred->hi >= lo) ? pred : 
+	(succ != NULL && succ->lo <= hi) ? succ : NULL;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    insert_range(ranges, p);
     return 1;
 }
 
@@ -433,19 +707,28 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
+    range_t **link = ranges;
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *link) != NULL && p->lo != lo)
+	link = (lo < p->lo) ? &p->left : &p->right;
+    if (p == NULL)
+	return;
+
+    /* Rotate it down below its higher priority child until it has at
+       most one child, then splice it out */
+    while (p->left != NULL && p->right != NULL) {
+	if (range_priority(p->left) > range_priority(p->right)) {
+	    rotate_right(link);
+	    link = &(*link)->right;
+	}
+	else {
+	    rotate_left(link);
+	    link = &(*link)->left;
+	}
     }
+    *link = (p->left != NULL) ? p->left : p->right;
+    free(p);
 }
 
 /*
@@ -453,13 +736,13 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    free(p);
     *ranges = NULL;
 }
 
@@ -469,7 +752,8 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory, or map it if
+ *     it is a binary trace (see bintrace.h)
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
@@ -487,14 +771,42 @@ static trace_t *read_trace(char *tracedir, char *filename)
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
+    trace->ops = NULL;
+    trace->bin = NULL;
+    trace->next_op = 0;
 	
-    /* Read the trace file header */
+    /* A binary trace is mapped rather than read, and its requests are 
+       decoded as they are replayed */
     strcpy(path, tracedir);
     strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
+    if ((trace->bin = (bintrace_t *)malloc(sizeof(bintrace_t))) == NULL)
+	unix_error("malloc failed in read_trace");
+    switch (bt_open(path, trace->bin)) {
+    case 1:
+	trace->sugg_heapsize = trace->bin->sugg_heapsize;
+	trace->num_ids = trace->bin->num_ids;
+	trace->num_ops = trace->bin->num_ops;
+	trace->weight = trace->bin->weight;
+	if ((trace->blocks = 
+	     (char **)malloc(trace->num_ids * sizeof(char *))) == NULL ||
+	    (trace->block_sizes = 
+	     (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	    unix_error("malloc failed in read_trace");
+	return trace;
+    case 0:
+	tracefile = fopen(path, "r");
+	break;
+    default:
+	tracefile = NULL;
+    }
+    free(trace->bin);
+    trace->bin = NULL;
+    if (tracefile == NULL) {
+	snprintf(msg, sizeof msg, "Could not open %.960s in read_trace", path);
 	unix_error(msg);
     }
+
+    /* Read the trace file header */
     fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
@@ -556,16 +868,61 @@ static trace_t *read_trace(char *tracedir, char *filename)
 
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated in read_trace(), and
+ *              unmap a binary trace.
  */
 void free_trace(trace_t *trace)
 {
+    if (trace->bin != NULL) { /* unmap a binary trace... */
+	bt_close(trace->bin);
+	free(trace->bin);
+    }
     free(trace->ops);         /* free the three arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
 }
 
+/*
+ * trace_rewind - Start over at the first request of a trace
+ */
+static void trace_rewind(trace_t *trace)
+{
+    if (trace->bin != NULL)
+	bt_rewind(trace->bin);
+    trace->next_op = 0;
+}
+
+/*
+ * trace_next - Copy the next request of a trace into op. Returns 0 
+ *     once every request has been returned.
+ */
+static int trace_next(trace_t *trace, traceop_t *op)
+{
+    unsigned index, size = 0;
+    int type;
+
+    if (trace->bin == NULL) {
+	if (trace->next_op == trace->num_ops)
+	    return 0;
+	*op = trace->ops[trace->next_op++];
+	return 1;
+    }
+
+    switch (bt_next(trace->bin, &type, &index, &size)) {
+    case 0:
+	return 0;
+    case -1:
+	app_error("Truncated or corrupt binary trace");
+    }
+    if (index >= (unsigned)trace->num_ids)
+	app_error("Request index out of range in binary trace");
+    op->type = type;
+    op->index = index;
+    op->size = size;
+    return 1;
+}
+
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
@@ -580,11 +937,12 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     int index;
     int size;
     int oldsize;
+    traceop_t op;
     char *newp;
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -595,11 +953,12 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-	index = trace->ops[i].index;
-	size = trace->ops[i].size;
+    trace_rewind(trace);
+    for (i = 0;  trace_next(trace, &op);  i++) {
+	index = op.index;
+	size = op.size;
 
-        switch (trace->ops[i].type) {
+        switch (op.type) {
 
         case ALLOC: /* mm_malloc */
 
@@ -611,7 +970,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
@@ -638,10 +997,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range tree */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
@@ -653,7 +1012,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -678,6 +1037,17 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* Check the blocks this request changed, or the whole heap */
+	if (check_heap && mm_check(1) != 0) {
+	    malloc_error(tracenum, i, "mm_check found the heap inconsistent.");
+	    return 0;
+	}
+    }
+
+    /* Check the whole heap once more at the end of the trace */
+    if (check_heap && mm_check(0) != 0) {
+	malloc_error(tracenum, i, "mm_check found the heap inconsistent.");
+	return 0;
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -689,10 +1059,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   largest size of the heap in bytes while running the student's 
+ *   malloc package on the trace. mem_sbrk() lets the package shrink
+ *   the heap, so this is the high water mark kept by memlib rather
+ *   than the final brk.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -700,6 +1070,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     int i;
     int index;
     int size, newsize, oldsize;
+    traceop_t op;
     int max_total_size = 0;
     int total_size = 0;
     char *p;
@@ -710,12 +1081,13 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    trace_rewind(trace);
+    for (i = 0;  trace_next(trace, &op);  i++) {
+        switch (op.type) {
 
         case ALLOC: /* mm_alloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
+	    index = op.index;
+	    size = op.size;
 
 	    if ((p = mm_malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
@@ -734,8 +1106,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
 	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
+	    index = op.index;
+	    newsize = op.size;
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
@@ -756,7 +1128,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
         case FREE: /* mm_free */
-	    index = trace->ops[i].index;
+	    index = op.index;
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
@@ -774,7 +1146,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_max_heapsize());
 }
 
 
@@ -786,6 +1158,7 @@ static void eval_mm_speed(void *ptr)
 {
     int i, index, size, newsize;
     char *p, *newp, *oldp, *block;
+    traceop_t op;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
@@ -794,20 +1167,21 @@ static void eval_mm_speed(void *ptr)
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    trace_rewind(trace);
+    for (i = 0;  TIMED_NEXT(trace, i, op);  i++)
+        switch (op.type) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op.index;
+            size = op.size;
             if ((p = mm_malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
 
 	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+	    index = op.index;
+            newsize = op.size;
 	    oldp = trace->blocks[index];
             if ((newp = mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
@@ -815,7 +1189,7 @@ static void eval_mm_speed(void *ptr)
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op.index;
             block = trace->blocks[index];
             mm_free(block);
             break;
@@ -825,6 +1199,379 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_latency - Replays a trace once, timing every request on its
+ *    own into the histogram of its type. The clock reads add a few tens
+ *    of ns to each sample, so this is for finding the tail, not for 
+ *    throughput.
+ */
+static void eval_mm_latency(trace_t *trace, latency_t *latency)
+{
+    struct timespec stv, etv;
+    int i, index;
+    traceop_t op;
+    char *p = NULL;
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
+
+    trace_rewind(trace);
+    for (i = 0;  trace_next(trace, &op);  i++) {
+	index = op.index;
+	clock_gettime(CLOCK_MONOTONIC, &stv);
+        switch (op.type) {
+
+        case ALLOC: /* mm_malloc */
+            p = mm_malloc(op.size);
+            break;
+
+	case REALLOC: /* mm_realloc */
+            p = mm_realloc(trace->blocks[index], op.size);
+            break;
+
+        case FREE: /* mm_free */
+            mm_free(trace->blocks[index]);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+        }
+	clock_gettime(CLOCK_MONOTONIC, &etv);
+
+	if (op.type != FREE) {
+	    if (p == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+	    trace->blocks[index] = p;
+	}
+	hist_record(&latency->op[op.type], 
+		    (etv.tv_sec - stv.tv_sec) * 1000000000UL + 
+		    etv.tv_nsec - stv.tv_nsec);
+    }
+}
+
+/*
+ * eval_mm_heapstats - Replays a trace once, sampling mm_stats into heap
+ *    whenever the bytes requested by live blocks reach a new peak, which
+ *    is where fragmentation decides whether the heap has to grow. The
+ *    search counters are those at the end of the trace.
+ */
+static void eval_mm_heapstats(trace_t *trace, mm_stats_t *heap)
+{
+    mm_stats_t last;
+    int i, index;
+    size_t total_size = 0, max_total_size = 0;
+    traceop_t op;
+    char *p;
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_heapstats");
+
+    trace_rewind(trace);
+    for (i = 0;  trace_next(trace, &op);  i++) {
+	index = op.index;
+        switch (op.type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(op.size)) == NULL)
+		app_error("mm_malloc error in eval_mm_heapstats");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = op.size;
+	    total_size += op.size;
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(trace->blocks[index], op.size)) == NULL)
+		app_error("mm_realloc error in eval_mm_heapstats");
+	    total_size += op.size - trace->block_sizes[index];
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = op.size;
+            break;
+
+        case FREE: /* mm_free */
+            mm_free(trace->blocks[index]);
+	    total_size -= trace->block_sizes[index];
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_heapstats");
+        }
+
+	if (total_size > max_total_size) {
+	    max_total_size = total_size;
+	    mm_stats(heap);
+	}
+    }
+
+    mm_stats(&last);
+    heap->searches = last.searches;
+    heap->search_steps = last.search_steps;
+}
+
+/*
+ * eval_region_speed - This is the function that is used by fcyc()
+ *    to time replaying a trace in a region: every block comes from one
+ *    mm_region_t, frees are dropped, and the region is released once
+ *    at the end. A realloc copies the payload into a new block, which
+ *    is what mm_realloc does when it cannot resize in place. Traces
+ *    that free a lot may not fit in the heap without frees; the replay
+ *    then stops early and reports 0 chunks.
+ */
+static void eval_region_speed(void *ptr)
+{
+    int i, index, size;
+    char *p;
+    traceop_t op;
+    mm_region_t region;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_region_speed");
+    mm_region_init(&region);
+    ((speed_t *)ptr)->chunks = 0;
+
+    trace_rewind(trace);
+    for (i = 0;  TIMED_NEXT(trace, i, op);  i++) {
+	index = op.index;
+	size = op.size;
+        switch (op.type) {
+
+        case ALLOC: /* mm_region_alloc */
+            if ((p = mm_region_alloc(&region, size)) == NULL) {
+		mm_region_release(&region);
+		return;
+	    }
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+            break;
+
+	case REALLOC: /* mm_region_alloc and copy */
+            if ((p = mm_region_alloc(&region, size)) == NULL) {
+		mm_region_release(&region);
+		return;
+	    }
+	    memcpy(p, trace->blocks[index], 
+		   trace->block_sizes[index] < (size_t)size ? 
+		   trace->block_sizes[index] : (size_t)size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+            break;
+
+        case FREE: /* dropped until the release */
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_region_speed");
+        }
+    }
+
+    ((speed_t *)ptr)->chunks = region.num_chunks;
+    mm_region_release(&region);
+}
+
+/*
+ * eval_mm_region - Times replaying a trace in a region, and finds the
+ *    peak heap size of that replay and of one with per-object frees,
+ *    which is what releasing everything at once costs in memory.
+ */
+static void eval_mm_region(speed_t *speed_params, region_stats_t *region)
+{
+    eval_region_speed(speed_params);
+    if (speed_params->chunks == 0) {
+	region->chunks = 0;
+	return;
+    }
+    region->secs = fsecs(eval_region_speed, speed_params);
+    region->heap = mem_max_heapsize();
+    region->chunks = speed_params->chunks;
+    eval_mm_speed(speed_params);
+    region->heap_free = mem_max_heapsize();
+}
+
+/*
+ * wall_secs - Returns the wall clock in seconds
+ */
+static double wall_secs(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + 1E-6 * tv.tv_usec;
+}
+
+/*
+ * replay_thread - Replays one shard of a trace against the mm package.
+ *    The heap has already been reset by the caller.
+ */
+static void *replay_thread(void *ptr)
+{
+    replay_t *replay = (replay_t *)ptr;
+    traceop_t *ops = replay->ops;
+    char **blocks = replay->blocks;
+    int i, index;
+    char *p;
+
+    pthread_barrier_wait(replay->start);
+    replay->begin = wall_secs();
+
+    for (i = 0;  i < replay->num_ops;  i++) {
+	index = ops[i].index;
+        switch (ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(ops[i].size)) == NULL)
+		app_error("mm_malloc error in replay_thread");
+            blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(blocks[index], ops[i].size)) == NULL)
+		app_error("mm_realloc error in replay_thread");
+            blocks[index] = p;
+            break;
+
+        case FREE: /* mm_free */
+            mm_free(blocks[index]);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in replay_thread");
+        }
+    }
+
+    replay->end = wall_secs();
+    return NULL;
+}
+
+/*
+ * shard_trace - Splits the requests of a trace into nthreads shards,
+ *    giving every request on id i to shard i % nthreads, where it
+ *    becomes id i / nthreads. Each shard is a well-formed trace of its
+ *    own, and together they never have more bytes live than the whole
+ *    trace does. A first pass counts the requests of each shard, so
+ *    the shards together hold one copy of the trace.
+ */
+static void shard_trace(trace_t *trace, int nthreads, replay_t *replays)
+{
+    int t;
+    traceop_t op;
+
+    for (t = 0; t < nthreads; t++)
+	replays[t].num_ops = 0;
+    trace_rewind(trace);
+    while (trace_next(trace, &op))
+	replays[op.index % nthreads].num_ops++;
+
+    for (t = 0; t < nthreads; t++) {
+	replays[t].ops = (traceop_t *)malloc((replays[t].num_ops + 1) * sizeof(traceop_t));
+	replays[t].blocks = (char **)calloc(trace->num_ids / nthreads + 1, sizeof(char *));
+	if (replays[t].ops == NULL || replays[t].blocks == NULL)
+	    unix_error("malloc in shard_trace failed");
+	replays[t].num_ops = 0;
+    }
+
+    trace_rewind(trace);
+    while (trace_next(trace, &op)) {
+	t = op.index % nthreads;
+	op.index /= nthreads;
+	replays[t].ops[replays[t].num_ops++] = op;
+    }
+}
+
+/*
+ * run_replay - Resets the heap and replays nthreads shards concurrently.
+ *    Returns the wall time from the first thread's start until the last
+ *    thread is done.
+ */
+static double run_replay(int nthreads, replay_t *replays)
+{
+    pthread_t *tids;
+    pthread_barrier_t start;
+    double begin, end;
+    int t;
+
+    if ((tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t))) == NULL)
+	unix_error("malloc in run_replay failed");
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in run_replay");
+
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (t = 0; t < nthreads; t++) {
+	replays[t].start = &start;
+	if (pthread_create(&tids[t], NULL, replay_thread, &replays[t]) != 0)
+	    app_error("pthread_create failed in run_replay");
+    }
+
+    pthread_barrier_wait(&start);
+    begin = DBL_MAX;
+    end = 0;
+    for (t = 0; t < nthreads; t++) {
+	pthread_join(tids[t], NULL);
+	if (replays[t].begin < begin)
+	    begin = replays[t].begin;
+	if (replays[t].end > end)
+	    end = replays[t].end;
+    }
+
+    pthread_barrier_destroy(&start);
+    free(tids);
+    return end - begin;
+}
+
+/*
+ * eval_mm_threads - Measures how the mm package scales when a trace is
+ *    replayed as nthreads shards at the same time, against replaying
+ *    the whole trace on one thread. Both take the best of REPLAY_REPS
+ *    runs.
+ */
+static void eval_mm_threads(trace_t *trace, int nthreads, 
+			    thread_stats_t *stats)
+{
+    replay_t whole, *replays;
+    double secs, lat, max;
+    int rep, t;
+
+    if ((replays = (replay_t *)calloc(nthreads, sizeof(replay_t))) == NULL)
+	unix_error("calloc in eval_mm_threads failed");
+    shard_trace(trace, 1, &whole);
+    shard_trace(trace, nthreads, replays);
+
+    stats->ops = trace->num_ops;
+    stats->secs1 = DBL_MAX;
+    stats->secs = DBL_MAX;
+    for (rep = 0; rep < REPLAY_REPS; rep++) {
+	if ((secs = run_replay(1, &whole)) < stats->secs1)
+	    stats->secs1 = secs;
+
+	if ((secs = run_replay(nthreads, replays)) < stats->secs) {
+	    stats->secs = secs;
+	    stats->avg_lat = max = 0;
+	    for (t = 0; t < nthreads; t++) {
+		if (replays[t].num_ops == 0)
+		    continue;
+		secs = replays[t].end - replays[t].begin;
+		lat = secs / replays[t].num_ops;
+		stats->avg_lat += secs / trace->num_ops;
+		if (lat > max)
+		    max = lat;
+	    }
+	    stats->max_lat = max;
+	}
+    }
+
+    for (t = 0; t < nthreads; t++) {
+	free(replays[t].ops);
+	free(replays[t].blocks);
+    }
+    free(whole.ops);
+    free(whole.blocks);
+    free(replays);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -835,30 +1582,32 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 {
     int i, newsize;
     char *p, *newp, *oldp;
+    traceop_t op;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    trace_rewind(trace);
+    for (i = 0;  trace_next(trace, &op);  i++) {
+        switch (op.type) {
 
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+	    if ((p = malloc(op.size)) == NULL) {
 		malloc_error(tracenum, i, "libc malloc failed");
 		unix_error("System message");
 	    }
-	    trace->blocks[trace->ops[i].index] = p;
+	    trace->blocks[op.index] = p;
 	    break;
 
 	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
+            newsize = op.size;
+	    oldp = trace->blocks[op.index];
 	    if ((newp = realloc(oldp, newsize)) == NULL) {
 		malloc_error(tracenum, i, "libc realloc failed");
 		unix_error("System message");
 	    }
-	    trace->blocks[trace->ops[i].index] = newp;
+	    trace->blocks[op.index] = newp;
 	    break;
 	    
         case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+	    free(trace->blocks[op.index]);
 	    break;
 
 	default:
@@ -879,21 +1628,23 @@ static void eval_libc_speed(void *ptr)
     int i;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
+    traceop_t op;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    trace_rewind(trace);
+    for (i = 0;  TIMED_NEXT(trace, i, op);  i++) {
+        switch (op.type) {
         case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
+	    index = op.index;
+	    size = op.size;
 	    if ((p = malloc(size)) == NULL)
 		unix_error("malloc failed in eval_libc_speed");
 	    trace->blocks[index] = p;
 	    break;
 
 	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
+	    index = op.index;
+	    newsize = op.size;
 	    oldp = trace->blocks[index];
 	    if ((newp = realloc(oldp, newsize)) == NULL)
 		unix_error("realloc failed in eval_libc_speed\n");
@@ -902,7 +1653,7 @@ static void eval_libc_speed(void *ptr)
 	    break;
 	    
         case FREE: /* free */
-	    index = trace->ops[i].index;
+	    index = op.index;
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
@@ -972,6 +1723,201 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printlatency - prints the latency percentiles of every request type 
+ *     on every trace, followed by those of all traces together
+ */
+static void printlatency(int n, stats_t *mm_stats, latency_t *latency)
+{
+    static char *names[3] = {"malloc", "free", "realloc"};
+    hist_t *total;
+    int i, op;
+
+    if ((total = (hist_t *)calloc(3, sizeof(hist_t))) == NULL)
+	unix_error("calloc in printlatency failed");
+
+    printf("%5s %-8s%9s%8s%8s%8s%9s\n", 
+	   "trace", "op", "count", "p50", "p99", "p99.9", "max");
+    for (i=0; i < n; i++) {
+	if (!mm_stats[i].valid)
+	    continue;
+	for (op = 0; op < 3; op++) {
+	    hist_t *h = &latency[i].op[op];
+	    if (h->count == 0)
+		continue;
+	    printf("%2d    %-8s%9lu%8lu%8lu%8lu%9lu\n", 
+		   i,
+		   names[op],
+		   h->count,
+		   hist_percentile(h, 50.0),
+		   hist_percentile(h, 99.0),
+		   hist_percentile(h, 99.9),
+		   h->max);
+	    hist_merge(&total[op], h);
+	}
+    }
+
+    for (op = 0; op < 3; op++) {
+	if (total[op].count == 0)
+	    continue;
+	printf("%5s %-8s%9lu%8lu%8lu%8lu%9lu\n", 
+	       "Total",
+	       names[op],
+	       total[op].count,
+	       hist_percentile(&total[op], 50.0),
+	       hist_percentile(&total[op], 99.0),
+	       hist_percentile(&total[op], 99.9),
+	       total[op].max);
+    }
+    free(total);
+}
+
+/*
+ * printheapstats - prints the heap statistics sampled by -s for every
+ *     valid trace: heap size, bytes in live and free blocks, free blocks,
+ *     the largest of them, external fragmentation, and the free blocks
+ *     a fit search examined on average over the whole trace.
+ */
+static void printheapstats(int n, stats_t *mm_stats, mm_stats_t *heap)
+{
+    int i;
+
+    printf("%5s%10s%10s%10s%8s%10s%7s%8s\n", 
+	   "trace", "heap KB", "live KB", "free KB", "blocks", "largest", 
+	   "frag", "steps");
+    for (i=0; i < n; i++) {
+	if (!mm_stats[i].valid)
+	    continue;
+	printf("%2d   %10.1f%10.1f%10.1f%8lu%10.1f%6.1f%%%8.2f\n", 
+	       i,
+	       heap[i].heap_size / 1024.0,
+	       heap[i].live_bytes / 1024.0,
+	       heap[i].free_bytes / 1024.0,
+	       heap[i].free_blocks,
+	       heap[i].largest_free / 1024.0,
+	       heap[i].fragmentation * 100.0,
+	       heap[i].searches == 0 ? 0.0 :
+	       (double)heap[i].search_steps / heap[i].searches);
+    }
+}
+
+/*
+ * printevents - prints the event counts of -e for every valid trace: 
+ *     requests, how many mm_malloc served from the thread cache, fit 
+ *     searches and the free blocks each walked on average, heap 
+ *     extensions and the KB they added, freed blocks by which 
+ *     neighbours coalesce() merged them with (none, next, previous,
+ *     both), how many allocated blocks were split, and mapped blocks.
+ */
+static void printevents(int n, stats_t *mm_stats, mm_events_t *events)
+{
+    int i;
+
+    printf("%5s%8s%7s%9s%7s%7s%8s%7s%7s%7s%7s%7s%6s\n", 
+	   "trace", "ops", "hit%", "searches", "steps", "sbrks", "sbrk KB",
+	   "none", "next", "prev", "both", "split%", "maps");
+    for (i=0; i < n; i++) {
+	mm_events_t *e = &events[i];
+	if (!mm_stats[i].valid)
+	    continue;
+	printf("%2d   %8lu%6.1f%%%9lu%7.2f%7lu%8.1f%7lu%7lu%7lu%7lu%6.1f%%%6lu\n", 
+	       i,
+	       e->mallocs + e->frees + e->reallocs,
+	       e->mallocs == 0 ? 0.0 : 100.0 * e->cache_hits / e->mallocs,
+	       e->searches,
+	       e->searches == 0 ? 0.0 : (double)e->search_steps / e->searches,
+	       e->extends,
+	       e->extend_bytes / 1024.0,
+	       e->coalesce[0], e->coalesce[1], e->coalesce[2], e->coalesce[3],
+	       e->split_tries == 0 ? 0.0 : 100.0 * e->splits / e->split_tries,
+	       e->maps);
+    }
+}
+
+/*
+ * printregionresults - prints the throughput of every valid trace with
+ *     per-object frees and in region mode, how much faster the region
+ *     is, and the peak heap size of both along with the chunks the 
+ *     region took. Traces too large to replay without frees say so.
+ */
+static void printregionresults(int n, stats_t *mm_stats, 
+			       region_stats_t *region)
+{
+    int i;
+
+    printf("%5s%10s%10s%12s%9s%10s%12s%8s\n", 
+	   "trace", "ops", "free Kops", "region Kops", "speedup", 
+	   "free KB", "region KB", "chunks");
+    for (i=0; i < n; i++) {
+	if (!mm_stats[i].valid)
+	    continue;
+	if (region[i].chunks == 0) {
+	    printf("%2d   %10.0f%10.0f   does not fit in the heap without "
+		   "frees\n", i, mm_stats[i].ops, 
+		   mm_stats[i].ops / 1e3 / mm_stats[i].secs);
+	    continue;
+	}
+	printf("%2d   %10.0f%10.0f%12.0f%8.2fx%10.1f%12.1f%8lu\n", 
+	       i,
+	       mm_stats[i].ops,
+	       mm_stats[i].ops / 1e3 / mm_stats[i].secs,
+	       mm_stats[i].ops / 1e3 / region[i].secs,
+	       mm_stats[i].secs / region[i].secs,
+	       region[i].heap_free / 1024.0,
+	       region[i].heap / 1024.0,
+	       region[i].chunks);
+    }
+}
+
+/*
+ * printthreadresults - prints the scaling of the mm package when every
+ *     trace is replayed as nthreads concurrent shards. Scaling is 
+ *     Kops(N) over N times Kops(1); ns/op is the mean time a thread 
+ *     spends per request, and max ns/op that of the slowest thread.
+ */
+static void printthreadresults(int n, int nthreads, stats_t *mm_stats,
+			       thread_stats_t *stats)
+{
+    int i;
+    double ops = 0;
+    double secs1 = 0;
+    double secs = 0;
+    double lat = 0;
+    double kops1, kopsn;
+
+    printf("%5s%9s%9s%9s%10s%10s\n", 
+	   "trace", "Kops(1)", "Kops(N)", "scaling", "ns/op", "max ns/op");
+    for (i=0; i < n; i++) {
+	if (!mm_stats[i].valid) {
+	    printf("%2d%12s%9s%9s%10s%10s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	kops1 = (stats[i].ops/1e3)/stats[i].secs1;
+	kopsn = (stats[i].ops/1e3)/stats[i].secs;
+	printf("%2d%12.0f%9.0f%8.0f%%%10.0f%10.0f\n", 
+	       i,
+	       kops1,
+	       kopsn,
+	       kopsn/(nthreads*kops1)*100.0,
+	       stats[i].avg_lat*1e9,
+	       stats[i].max_lat*1e9);
+	ops += stats[i].ops;
+	secs1 += stats[i].secs1;
+	secs += stats[i].secs;
+	lat += stats[i].avg_lat*stats[i].ops;
+    }
+
+    /* Print the aggregate results for the set of traces */
+    kops1 = (ops/1e3)/secs1;
+    kopsn = (ops/1e3)/secs;
+    printf("%5s%9.0f%9.0f%8.0f%%%10.0f\n", 
+	   "Total",
+	   kops1,
+	   kopsn,
+	   kopsn/(nthreads*kops1)*100.0,
+	   lat/ops*1e9);
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,14 +1950,20 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValpsecr] [-f <file>] [-t <dir>] [-T <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-c         Check the heap after every request (faster with make CHECK=1).\n");
+    fprintf(stderr, "\t-e         Print hot-path event counts (make EVENTS=1).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-p         Print per-request latency percentiles.\n");
+    fprintf(stderr, "\t-r         Also replay each trace in a region, freeing it at once.\n");
+    fprintf(stderr, "\t-s         Print heap statistics at the peak of each trace.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Also replay each trace as <n> concurrent shards.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -2,7 +2,19 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            The heap is a range of virtual memory reserved up front, which
+ *            the system only backs as its pages are first touched. With
+ *            MEM_USE_MMAP set in config.h, pages are also committed as the
+ *            brk grows and returned to the OS as it shrinks.
+ *
+ *            The heap is made of MEM_REGIONS regions of up to MAX_HEAP
+ *            bytes, laid out side by side, each with its own brk pointer.
+ *            mem_sbrk works on region 0. Besides the regions, the package
+ *            may map chunks of its own with mem_map; they count towards
+ *            the heap size.
  */
+#define _GNU_SOURCE             /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,28 +22,92 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* 
+ * Set MEM_QUIET to fail without a word on stderr, as the package must 
+ * when it stands in for the system malloc (libmm.so)
+ */
+#ifndef MEM_QUIET
+#define MEM_QUIET 0
+#endif
+
+/* granularity of committing and decommitting pages in MEM_USE_MMAP mode */
+#define MEM_COMMIT_CHUNK (64*(1<<10))  
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
 
+/* region r spans mem_start_brk + r*MAX_HEAP up to its brk pointer */
+typedef struct {
+    char *brk;               /* points to last byte of the region */
+    char *commit_brk;        /* end of the pages committed so far (MEM_USE_MMAP) */
+} region_t;
+
+static region_t regions[MEM_REGIONS];
+static size_t mem_brk_size;  /* bytes between the start and brk of all regions */
+
+/* a chunk mapped by mem_map */
+typedef struct mapping_t {
+    char *lo;
+    size_t size;
+    struct mapping_t *next;
+} mapping_t;
+
+static mapping_t *mappings;  /* every chunk mapped since the heap was last reset */
+static mapping_t *free_mappings; /* records ready for reuse, linked by next */
+static size_t mem_mapped;    /* bytes in those chunks */
+static size_t mem_max_size;  /* largest heap size since the heap was last reset */
+
+/* mem_map and friends may be called by several threads at once */
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* 
- * mem_init - initialize the memory system model
+ * mem_init - initialize the memory system model. Calling it again
+ *    only resets the brk pointer to make an empty heap.
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    int r;
+
+    if (mem_start_brk != NULL) {
+	mem_reset_brk();
+	return;
+    }
+
+#if MEM_USE_MMAP
+    /* reserve the address space; pages are committed by mem_sbrk */
+    mem_start_brk = (char *)mmap(NULL, (size_t)MAX_HEAP * MEM_REGIONS, PROT_NONE, 
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == (char *)MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
+#else
+    /* 
+     * reserve the storage we will use to model the available VM; the
+     * system only backs the pages the regions' brk pointers reach
+     */
+    mem_start_brk = (char *)mmap(NULL, (size_t)MAX_HEAP * MEM_REGIONS, 
+				 PROT_READ | PROT_WRITE, 
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == (char *)MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+#endif
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_max_addr = mem_start_brk + (size_t)MAX_HEAP * MEM_REGIONS;  /* max legal heap address */
+    for (r = 0; r < MEM_REGIONS; r++) {     /* heap is empty initially */
+	regions[r].brk = mem_start_brk + (size_t)r * MAX_HEAP;
+	regions[r].commit_brk = regions[r].brk;
+    }
+    mem_brk_size = 0;
+    mem_max_size = 0;
 }
 
 /* 
@@ -39,35 +115,291 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_start_brk, (size_t)MAX_HEAP * MEM_REGIONS);
+    mem_start_brk = NULL;
+}
+
+/* 
+ * mem_region_start - return the address of the first byte of region r
+ */
+static char *mem_region_start(int r)
+{
+    return mem_start_brk + (size_t)r * MAX_HEAP;
+}
+
+/*
+ * mem_commit - make region r usable up to (at least) new_brk, or give 
+ *    back the pages above it. Returns -1 if the pages could not be
+ *    committed. A no-op unless MEM_USE_MMAP is set.
+ */
+static int mem_commit(int r, char *new_brk)
+{
+#if MEM_USE_MMAP
+    region_t *region = &regions[r];
+    size_t offset = (size_t)(new_brk - mem_region_start(r));
+    char *new_commit = mem_region_start(r) + 
+	(offset + MEM_COMMIT_CHUNK - 1) / MEM_COMMIT_CHUNK * MEM_COMMIT_CHUNK;
+
+    if (new_commit > mem_region_start(r) + MAX_HEAP)
+	new_commit = mem_region_start(r) + MAX_HEAP;
+    if (new_commit > region->commit_brk) {
+	if (mprotect(region->commit_brk, new_commit - region->commit_brk, 
+		     PROT_READ | PROT_WRITE) < 0)
+	    return -1;
+    }
+    else if (new_commit < region->commit_brk) {
+	madvise(new_commit, region->commit_brk - new_commit, MADV_DONTNEED);
+	mprotect(new_commit, region->commit_brk - new_commit, PROT_NONE);
+    }
+    region->commit_brk = new_commit;
+#endif
+    return 0;
+}
+
+/*
+ * mem_track_max - record the current heap size in the high water mark.
+ *    The caller holds mem_lock.
+ */
+static void mem_track_max(void)
+{
+    size_t size = mem_brk_size + mem_mapped;
+
+    if (size > mem_max_size)
+	mem_max_size = size;
+}
+
+/*
+ * mem_new_mapping - return a record for a new chunk, or NULL. Records
+ *    are carved from pages of their own rather than malloc'd, so that
+ *    the package can stand in for the system malloc. The caller holds
+ *    mem_lock.
+ */
+static mapping_t *mem_new_mapping(void)
+{
+    size_t i, n = mem_pagesize() / sizeof(mapping_t);
+    mapping_t *m;
+
+    if (free_mappings == NULL) {
+	m = mmap(NULL, mem_pagesize(), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (m == (mapping_t *)MAP_FAILED)
+	    return NULL;
+	for (i = 0; i < n; i++) {
+	    m[i].next = free_mappings;
+	    free_mappings = &m[i];
+	}
+    }
+    m = free_mappings;
+    free_mappings = m->next;
+    return m;
+}
+
+/*
+ * mem_free_mapping - keep the record of an unmapped chunk for reuse. 
+ *    The caller holds mem_lock.
+ */
+static void mem_free_mapping(mapping_t *m)
+{
+    m->next = free_mappings;
+    free_mappings = m;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    unmapping every chunk mapped with mem_map
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mapping_t *m;
+    int r;
+
+    while ((m = mappings) != NULL) {
+	mappings = m->next;
+	munmap(m->lo, m->size);
+	mem_free_mapping(m);
+    }
+    mem_mapped = 0;
+    for (r = 0; r < MEM_REGIONS; r++) {
+	regions[r].brk = mem_region_start(r);
+	mem_commit(r, regions[r].brk);
+    }
+    mem_brk_size = 0;
+    mem_max_size = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, and in MEM_USE_MMAP mode hands
+ *    the pages above the new brk back to the OS.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_region_sbrk(0, incr);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+/* 
+ * mem_region_sbrk - mem_sbrk for region r. Calls for different regions
+ *    may run in parallel; calls for the same region must not.
+ */
+void *mem_region_sbrk(int r, int incr) 
+{
+    region_t *region = &regions[r];
+    char *old_brk = region->brk;
+
+    if ((incr < 0 && (old_brk + incr) < mem_region_start(r)) ||
+	(incr > 0 && (old_brk + incr) > mem_region_start(r) + MAX_HEAP) ||
+	mem_commit(r, old_brk + incr) < 0) {
 	errno = ENOMEM;
+#if !MEM_QUIET
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+#endif
 	return (void *)-1;
     }
-    mem_brk += incr;
+    pthread_mutex_lock(&mem_lock);
+    region->brk += incr;
+    mem_brk_size += incr;
+    mem_track_max();
+    pthread_mutex_unlock(&mem_lock);
     return (void *)old_brk;
 }
 
+/*
+ * mem_region_hi - return address of the last byte of region r
+ */
+void *mem_region_hi(int r)
+{
+    return (void *)(regions[r].brk - 1);
+}
+
+/*
+ * mem_find_mapping - the link to the chunk starting at lo, or to the
+ *    end of the list if there is none. The caller holds mem_lock.
+ */
+static mapping_t **mem_find_mapping(void *lo)
+{
+    mapping_t **link = &mappings;
+
+    while (*link != NULL && (*link)->lo != lo)
+	link = &(*link)->next;
+    return link;
+}
+
+/*
+ * mem_map - map a page-aligned chunk of size bytes (a multiple of the 
+ *    page size) outside the brk heap. Returns NULL if that fails.
+ */
+void *mem_map(size_t size)
+{
+    char *lo = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    mapping_t *m;
+
+    if (lo == (char *)MAP_FAILED)
+	return NULL;
+    pthread_mutex_lock(&mem_lock);
+    if ((m = mem_new_mapping()) == NULL) {
+	pthread_mutex_unlock(&mem_lock);
+	munmap(lo, size);
+	return NULL;
+    }
+    m->lo = lo;
+    m->size = size;
+    m->next = mappings;
+    mappings = m;
+    mem_mapped += size;
+    mem_track_max();
+    pthread_mutex_unlock(&mem_lock);
+    return lo;
+}
+
+/*
+ * mem_unmap - unmap a chunk returned by mem_map or mem_remap
+ */
+void mem_unmap(void *lo)
+{
+    mapping_t **link, *m;
+    size_t size;
+
+    pthread_mutex_lock(&mem_lock);
+    link = mem_find_mapping(lo);
+    assert(*link != NULL);
+    m = *link;
+    *link = m->next;
+    size = m->size;
+    mem_mapped -= size;
+    mem_free_mapping(m);
+    pthread_mutex_unlock(&mem_lock);
+    munmap(lo, size);
+}
+
+/*
+ * mem_remap - resize a chunk returned by mem_map or mem_remap to size
+ *    bytes, moving it if it cannot grow where it is. Returns the new
+ *    start of the chunk, or NULL (leaving it untouched) if that fails.
+ */
+void *mem_remap(void *lo, size_t size)
+{
+    mapping_t **link, *m;
+    char *new_lo;
+
+    pthread_mutex_lock(&mem_lock);
+    link = mem_find_mapping(lo);
+    assert(*link != NULL);
+    m = *link;
+    new_lo = mremap(m->lo, m->size, size, MREMAP_MAYMOVE);
+    if (new_lo == (char *)MAP_FAILED) {
+	pthread_mutex_unlock(&mem_lock);
+	return NULL;
+    }
+    mem_mapped = mem_mapped - m->size + size;
+    m->lo = new_lo;
+    m->size = size;
+    mem_track_max();
+    pthread_mutex_unlock(&mem_lock);
+    return new_lo;
+}
+
+/*
+ * mem_contains - return 1 if the bytes lo..hi lie within a single region
+ *    or mapped chunk, 0 otherwise
+ */
+int mem_contains(void *lo, void *hi)
+{
+    mapping_t *m;
+    int found = 0;
+    int r;
+
+    if ((char *)lo >= mem_start_brk && (char *)lo < mem_max_addr) {
+	r = ((char *)lo - mem_start_brk) / MAX_HEAP;
+	return (char *)hi < regions[r].brk;
+    }
+    pthread_mutex_lock(&mem_lock);
+    for (m = mappings; m != NULL && !found; m = m->next)
+	found = (char *)lo >= m->lo && (char *)hi < m->lo + m->size;
+    pthread_mutex_unlock(&mem_lock);
+    return found;
+}
+
+/*
+ * mem_discard - tell the memory system that the contents of the whole
+ *    pages inside [lo, lo+len) are no longer needed. The range stays 
+ *    part of the heap and reads back as zeros once discarded. A no-op
+ *    unless MEM_USE_MMAP is set.
+ */
+void mem_discard(void *lo, size_t len)
+{
+#if MEM_USE_MMAP
+    size_t pagesize = mem_pagesize();
+    char *first = (char *)(((size_t)lo + pagesize - 1) & ~(pagesize - 1));
+    char *last = (char *)(((size_t)lo + len) & ~(pagesize - 1));
+
+    if (first < last)
+	madvise(first, last - first, MADV_DONTNEED);
+#endif
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -77,19 +409,41 @@ void *mem_heap_lo()
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_hi - return address of last heap byte, in the last region
+ *    in use
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    int r = MEM_REGIONS - 1;
+
+    while (r > 0 && regions[r].brk == mem_region_start(r))
+	r--;
+    return mem_region_hi(r);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, mapped chunks included
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_brk_size + mem_mapped;
+}
+
+/*
+ * mem_mapsize() - returns the bytes in mapped chunks
+ */
+size_t mem_mapsize()
+{
+    return mem_mapped;
+}
+
+/*
+ * mem_max_heapsize() - returns the largest heap size in bytes since the
+ *    heap was last reset, i.e. its high water mark
+ */
+size_t mem_max_heapsize() 
+{
+    return mem_max_size;
 }
 
 /*
@@ -99,3 +453,24 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_fork_prepare, mem_fork_parent, mem_fork_child - fork handlers
+ *    for a process that uses the package as its malloc: hold mem_lock
+ *    across fork, so that the child does not inherit it locked by a 
+ *    thread that does not exist there
+ */
+void mem_fork_prepare(void)
+{
+    pthread_mutex_lock(&mem_lock);
+}
+
+void mem_fork_parent(void)
+{
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void mem_fork_child(void)
+{
+    pthread_mutex_init(&mem_lock, NULL);
+}
@@ -3,9 +3,21 @@
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
+void *mem_region_sbrk(int r, int incr);
+void *mem_region_hi(int r);
+void mem_discard(void *lo, size_t len);
+void *mem_map(size_t size);
+void mem_unmap(void *lo);
+void *mem_remap(void *lo, size_t size);
+int mem_contains(void *lo, void *hi);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_mapsize(void);
+size_t mem_max_heapsize(void);
 size_t mem_pagesize(void);
+void mem_fork_prepare(void);
+void mem_fork_parent(void);
+void mem_fork_child(void);
 
@@ -2,23 +2,62 @@
  * mm.c - The fastest, not the most memory-efficient malloc package.
  *
  * In this approach, a block is allocated by finding its appropriate bin based on its size.
+ * A bitmap of non-empty bins lets a request skip straight to the first bin that can satisfy it.
  * The free block found is then allocated and splitted if necessary, the free block returns 
  * to its appropriate free list. When a block is freed, it is coalesced with adjacent blocks.
- * The combined free block returns to its free list. Each block has at least one header, one footer,
- * and a pred and succ pointers for free block management. Realloc is implemented using mm_malloc and
- * mm_free, which handles three main cases: new block shrinks, new block expands on an adjacent next
- * block, and others where calls to malloc and memcpy will be needed. However, there are room for
- * improvements in which previous free block can be considered, which will likely reduce fragmentation.
+ * The combined free block returns to its free list. Free blocks above 8 KB are kept in a treap
+ * ordered by size and address instead, so they are found best fit in O(log n).
  *
+ * Allocated blocks carry only a header; free blocks add a footer and pred and succ links (left and
+ * right in the treap) for free block management. Bit 1 of every header tells whether the previous
+ * block is allocated, so a footer is only needed, and only read, when that block is free.
+ *
+ * Realloc shrinks a block in place, and grows it in place whenever it can: into a free next block, into a
+ * free previous block (moving the payload down with memmove), into both, or by extending the heap when
+ * the block ends it. Only otherwise is the payload copied into a new block. Blocks that realloc keeps
+ * growing are tracked in a few grower slots and get geometric slack once they have to move, so a chain
+ * of growing reallocs copies O(n) bytes in total; the slack is given back before the heap grows.
+ *
+ * Requests of up to SLAB_MAX bytes are served from slab runs instead: page-sized blocks carved into
+ * headerless objects of one size class, found again on free through a map of run pages.
+ *
+ * Blocks of at least mmap_threshold bytes, or too large for an arena, do not enter the heap at all: each
+ * gets a chunk mapped for it alone with mem_map, which mm_free unmaps and mm_realloc resizes with mem_remap
+ * without copying. Mapped blocks may grow up to MAP_MAX, the most a header word can hold.
+ *
+ * mm_memalign carves aligned blocks out of free blocks that still fit once aligned, and gives the parts cut
+ * off in front and behind back to the bins, where they coalesce like any other free block.
+ *
+ * mm_malloc_batch carves many blocks of one size back to back out of a single free block under one lock,
+ * and mm_free_batch sorts the blocks it frees by address so that each run of neighbours is coalesced once.
+ *
+ * On a heap backed by mmap, freeing a large block gives memory back to the system: the top of the heap
+ * is trimmed with a negative sbrk when it ends in a large free block, and the pages inside other
+ * large free blocks are discarded.
+ *
+ * The heap is split into arenas, one per CPU up to MEM_REGIONS, each a memlib region with its own bins,
+ * slab runs and lock. A thread allocates from the arena of the CPU it first runs on, and once that
+ * arena's region is full it spills into the other arenas in region order; a block is freed,
+ * reallocated and coalesced in the arena its address falls in. A thread freeing a block of another
+ * arena does not wait for that arena's lock: if the lock is taken, it pushes the block on the arena's
+ * lock-free remote free list, which is drained in one batch by whoever locks the arena next, or by a
+ * thread about to grow its heap.
+ * Each thread keeps a small cache of recently freed blocks of up to TCACHE_MAX bytes in front of it,
+ * so most small malloc/free pairs never take a lock; caches are refilled and flushed in batches.
  */
+#define _GNU_SOURCE         /*sched_getcpu*/
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -36,171 +75,591 @@ team_t team = {
     /* Second member's email address (leave blank if none) */
     ""};
 
-/*double word (8) alignment */
-#define ALIGNMENT 8 
+/*16-byte alignment, as long double and max_align_t need on x86-64. Payloads stay aligned behind 4-byte
+headers because every header sits 4 bytes short of a multiple of ALIGNMENT and every block size is one*/
+#define ALIGNMENT 16
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t))) /*one word size - 8 bytes*/
+#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
+#define WSIZE 4             /*headers, footers and free list links are 4-byte words*/
 
 #define ALLOCATED 1
 #define FREE 0
-#define MINBLOCKSIZE (SIZE_T_SIZE + SIZE_T_SIZE + SIZE_T_SIZE + SIZE_T_SIZE) /*header, footer, pred, succ*/
-#define BINCOUNT 20
+#define PREV_ALLOCATED 2    /*header bit set when the block right before is allocated*/
+#define MINBLOCKSIZE (WSIZE + WSIZE + WSIZE + WSIZE) /*header, footer, pred, succ of a free block*/
+#define BINCOUNT 10          /*list bins for blocks up to 8 KB*/
+#define TREE_BIN BINCOUNT    /*bin number of the treap holding every larger free block*/
+_Static_assert(MM_STAT_BINS == BINCOUNT + 1, "mm_stats_t has a slot per list bin and one for the treap");
+#define ARENA_OVERHEAD (ALIGNMENT - WSIZE + MINBLOCKSIZE * 2 * BINCOUNT + WSIZE)  /*padding, bin sentinels and epilogue*/
+
+#define SLAB_MAX 128                                /*largest request served from a slab run*/
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT)         /*one size class per multiple of ALIGNMENT*/
+#define RUN_SIZE 4096                               /*bytes of a slab run, which is also its alignment*/
+
+#define TCACHE_MIN ALIGN(SLAB_MAX + 1 + WSIZE)       /*smallest block size kept in thread caches: smaller requests go to the slabs*/
+#define TCACHE_MAX 512                              /*largest block size kept in thread caches*/
+#define TCACHE_BINS (SLAB_CLASSES + (TCACHE_MAX - TCACHE_MIN) / ALIGNMENT + 1)    /*slab classes, then one cache bin per block size*/
+#define TCACHE_FILL 7                               /*blocks a cache bin holds before flushing*/
+#define TCACHE_BATCH 4                              /*blocks moved between a cache and its arena at once*/
+
+#define RELEASE_THRESHOLD (256 * 1024)              /*free blocks this large give their memory back to the system*/
+#define TRIM_KEEP (64 * 1024)                       /*free bytes left at the end of the heap when trimming it*/
+#define MMAP_THRESHOLD (1 << 20)                    /*default block size from which a block is mapped on its own*/
+#define MAP_MAX ((size_t)UINT32_MAX & ~(size_t)0xFFFF)  /*largest chunk a block is mapped in, as its size goes in a header word*/
+#define GROWER_SLOTS 8                              /*growing blocks tracked for realloc slack at once*/
+#define SORT_INSERTION 64                           /*largest batch mm_free_batch sorts without qsort*/
+
+/*built with MM_EVENTS set, every thread counts hot-path events for mm_events, and the same events fire
+USDT probes of provider mm for perf or bpftrace where <sys/sdt.h> is available. Without it both compile away*/
+#ifndef MM_EVENTS
+#define MM_EVENTS 0
+#endif
+#if MM_EVENTS
+/*through threadCache: the first count after mm_init would be wiped by the reset of a stale cache*/
+#define EVENT(field, n) (threadCache()->events.field += (n))
+#else
+#define EVENT(field, n) ((void)0)
+#endif
+#if MM_EVENTS && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(mm, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(mm, name, a, b)
+#endif
+#endif
+#ifndef PROBE1
+#define PROBE1(name, a) ((void)0)
+#define PROBE2(name, a, b) ((void)0)
+#endif
+
+/*built with MM_CHECK set, every header write logs its block for mm_check(1), which then checks only those
+blocks; without it the log compiles away and mm_check(1) checks everything*/
+#ifndef MM_CHECK
+#define MM_CHECK 0
+#endif
+#define CHECK_LOG 64                                /*blocks logged per arena before the next check falls back to a full one*/
+
+/*a header or footer word, or a free list link stored as an offset from heap_base with 0 for NULL.
+MEM_REGIONS * MAX_HEAP keeps every offset within 32 bits*/
+typedef unsigned int word_t;
+
+char* heap_base;            /*first byte of region 0, which never holds a block header*/
+size_t mmap_threshold = MMAP_THRESHOLD;
+unsigned int heap_epoch;    /*bumped by mm_init so caches filled from an older heap are dropped*/
+
+/*a slab run is one allocated block of exactly RUN_SIZE bytes whose header sits right before a RUN_SIZE
+boundary, so runs pack back to back and no other block's payload starts in a run's page. Its payload
+is the run_t below, starting on the boundary, followed by equal objects of a small size class.
+Objects carry no header: mm_free recognises them through runmap and finds the run, and with it the
+object size, by rounding the address down to RUN_SIZE*/
+typedef struct run_t {
+    struct run_t* next;     /*partially used runs of the same class*/
+    struct run_t* prev;
+    void* free_objs;        /*freed objects, linked through their first word*/
+    char* unused;           /*objects from here on have never been handed out*/
+    unsigned int objsize;
+    unsigned int capacity;
+    unsigned int live;      /*objects handed out, including those sitting in thread caches*/
+} run_t;
+
+/*runmap[i] is set when the i-th RUN_SIZE page counted from heap_base is a run*/
+unsigned char runmap [MEM_REGIONS * (MAX_HEAP / RUN_SIZE)];
 
-size_t* bins [BINCOUNT];    /*segregated free list bins*/
+/*a block realloc has grown, which may hold slack beyond what the last request needed. Only blocks
+whose needed size exceeds TCACHE_MAX are tracked, so they are always freed under their arena's lock*/
+typedef struct {
+    word_t* blk;            /*NULL for an unused slot*/
+    size_t used;            /*block size the last request needed*/
+    size_t hint;            /*block size the caller expects it to reach, 0 if unknown*/
+    unsigned int grows;     /*growing reallocs seen*/
+    unsigned int stamp;     /*last use, the stalest slot is reused first*/
+} grower_t;
+
+/*an arena is one memlib region with its own free blocks, slab runs and growers, all guarded by its lock.
+Blocks never cross arenas, and region r spans [heap_base + r * MAX_HEAP, heap_base + (r + 1) * MAX_HEAP),
+so the arena owning any heap address follows from the address*/
+typedef struct {
+    pthread_mutex_t lock;
+    int region;
+    int ready;                              /*set once the region holds the sentinels and an epilogue*/
+    word_t* bins [BINCOUNT];                /*segregated free list bins*/
+    word_t tree_root;                       /*offset of the root of the large block treap*/
+    unsigned int binmap;                    /*bit b is set when bins[b], or the treap for TREE_BIN, holds at least one free block*/
+    size_t bin_blocks [BINCOUNT + 1];       /*free blocks per bin, TREE_BIN included, for mm_stats*/
+    size_t bin_bytes [BINCOUNT + 1];
+    size_t searches;                        /*fit searches, and free blocks they examined*/
+    size_t search_steps;
+    run_t* partial_runs [SLAB_CLASSES];     /*runs with at least one object left, per class*/
+    grower_t growers [GROWER_SLOTS];
+    int grower_count;
+    unsigned int grower_clock;
+    void* remote;                           /*payloads freed by threads of other arenas, linked through their first word*/
+#if MM_CHECK
+    word_t touched [CHECK_LOG];             /*offsets of blocks whose header changed since the last check, 0 once dropped*/
+    int touched_count;                      /*past CHECK_LOG, too many to log*/
+#endif
+} arena_t;
+
+arena_t arenas [MEM_REGIONS];
+int arena_count;            /*arenas threads are spread over: one per CPU, up to MEM_REGIONS*/
+
+/*per-thread cache of recently freed small blocks and slab objects, served without taking an arena lock.
+Bins below SLAB_CLASSES hold slab objects, the rest hold blocks by size, from any arena: only sizes of
+TCACHE_MIN to TCACHE_MAX, which mm_malloc can hand out again, as smaller ones would sit there unused. Cached blocks stay
+marked ALLOCATED in the heap; entries are payload pointers linked through their first word. The cache
+also remembers the arena the thread allocates from*/
+typedef struct {
+    void* head[TCACHE_BINS];
+    int count[TCACHE_BINS];
+    arena_t* arena;
+    unsigned int epoch;
+#if MM_EVENTS
+    mm_events_t events;                 /*this thread's events on the current heap*/
+#endif
+} tcache_t;
+
+static __thread tcache_t tcache;
+static pthread_key_t tcache_key;        /*only used to flush a cache back when its thread exits*/
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+#if MM_EVENTS
+static mm_events_t retired_events;      /*events of threads that have exited since mm_init*/
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /*helper functions*/
-void print_free_list(size_t* free_list_h);
-size_t blockSize(size_t* head){return (*head) & (~0x7);}
-size_t allocStatus(size_t* head){return (*head) & (0x1);}
-void setBlockSize(size_t* head, size_t size)
+void print_free_list(word_t* free_list_h);
+size_t blockSize(word_t* head){return (*head) & (~0x7);}
+size_t allocStatus(word_t* head){return (*head) & (0x1);}
+size_t prevAllocStatus(word_t* head){return ((*head) & PREV_ALLOCATED) ? ALLOCATED : FREE;}
+word_t* nextBlock(word_t *head){return head + blockSize(head) / WSIZE;}
+
+#if MM_CHECK
+arena_t* arenaOf(void* ptr);
+word_t toOffset(word_t* head);
+
+/*log a block whose header is about to be written at head with size for mm_check(1). Blocks logged inside
+it stopped being blocks, so they are dropped; the caller holds the arena lock*/
+void touchBlock(word_t* head, size_t size)
+{
+    arena_t* a = arenaOf(head);
+    if (a->touched_count > CHECK_LOG)               /*the next check is a full one anyway*/
+        return;
+    word_t lo = toOffset(head);
+    word_t hi = lo + size;
+    for (int i = 0; i < a->touched_count; i++)
+        if (a->touched[i] > lo && a->touched[i] < hi)
+            a->touched[i] = 0;
+    if (a->touched_count < CHECK_LOG)
+        a->touched[a->touched_count] = lo;
+    a->touched_count++;
+}
+#define TOUCH(head, size) touchBlock(head, size)
+#else
+#define TOUCH(head, size) ((void)0)
+#endif
+
+/*start a header on memory that did not hold one: a block of size, not allocated*/
+void initBlock(word_t* head, size_t size, int prev_alloc_status)
+{
+    TOUCH(head, size);
+    *head = size | (prev_alloc_status == ALLOCATED ? PREV_ALLOCATED : 0);
+}
+
+/*resize a block in its header, keeping both status bits. reclaimSlack shrinks growers that their owner
+may be freeing at the same time, so the store is atomic (see setAllocStatus); a grower stays above
+TCACHE_MAX either way, so mm_free takes the same path with the old or the new size*/
+void setBlockSize(word_t* head, size_t size)
 {
-    *head = size;
-    *(head + blockSize(head) / SIZE_T_SIZE - 1) = size;
+    TOUCH(head, size);
+    __atomic_store_n(head, size | ((*head) & (ALLOCATED | PREV_ALLOCATED)), __ATOMIC_RELAXED);
 }
 
-void setAllocStatus(size_t* head, int alloc_status)
+/*a free block also gets a footer repeating its size; the next block's prev-alloc bit follows along.
+The next block may be allocated to another thread that reads its size without a lock in mm_free,
+so that word is stored atomically (a plain store on x86)*/
+void setAllocStatus(word_t* head, int alloc_status)
 {
+    word_t* next = nextBlock(head);
+    TOUCH(head, blockSize(head));
     if (alloc_status == ALLOCATED)
     {
         *head |= ALLOCATED;
-        *(head + blockSize(head) / SIZE_T_SIZE - 1) |= ALLOCATED;
+        __atomic_store_n(next, *next | PREV_ALLOCATED, __ATOMIC_RELAXED);
     }
         
     else
     {
         *head &= ~ALLOCATED;
-        *(head + blockSize(head) / SIZE_T_SIZE - 1) &= ~ALLOCATED;
+        *(next - 1) = blockSize(head);
+        __atomic_store_n(next, *next & ~PREV_ALLOCATED, __ATOMIC_RELAXED);
     } 
 }
 
-size_t* nextBlock(size_t *head){return head + blockSize(head) / SIZE_T_SIZE;}
-size_t* prevBlock(size_t* head){return head - blockSize(head - 1) / SIZE_T_SIZE;}
+word_t* prevBlock(word_t* head){return head - blockSize(head - 1) / WSIZE;}
 
-size_t* getPred(size_t* head){return (size_t*) (*(head + 1));}
-size_t* getSucc(size_t* head){return (size_t*) (*(head + 2));}
-void setPred(size_t* head, size_t* ptr){*(head + 1) = ptr;}
-void setSucc(size_t* head, size_t* ptr){*(head + 2) = ptr;}
+word_t toOffset(word_t* head){return head == NULL ? 0 : (word_t)((char*)head - heap_base);}
+word_t* fromOffset(word_t offset){return offset == 0 ? NULL : (word_t*)(heap_base + offset);}
 
-int endOfList(size_t* head){return (getSucc(head) == NULL);}
-int atEpilogue(size_t* head){return (allocStatus(head) == ALLOCATED) && (blockSize(head) == 0);}
+/*the regions own [heap_base, heap_base + MEM_REGIONS * MAX_HEAP), so any payload outside is a mapped block*/
+int isMapped(void* ptr){return (size_t)((char*)ptr - heap_base) >= (size_t)MAX_HEAP * MEM_REGIONS;}
+arena_t* arenaOf(void* ptr){return &arenas[((char*)ptr - heap_base) / MAX_HEAP];}
+word_t* getPred(word_t* head){return fromOffset(*(head + 1));}
+word_t* getSucc(word_t* head){return fromOffset(*(head + 2));}
+void setPred(word_t* head, word_t* ptr){*(head + 1) = toOffset(ptr);}
+void setSucc(word_t* head, word_t* ptr){*(head + 2) = toOffset(ptr);}
+
+int endOfList(word_t* head){return (getSucc(head) == NULL);}
+int atEpilogue(word_t* head){return (allocStatus(head) == ALLOCATED) && (blockSize(head) == 0);}
 
 /*key functions' signatures*/
-void allocSplit(size_t total, size_t taken, size_t* taken_blk);
-void* coalesce(size_t* to_free);
-void splice(size_t* head);  /*reconnect the predecessor and the successor of a block*/
-void insertFreeBlock(size_t* free_list, size_t* head);
+void allocSplit(arena_t* a, size_t total, size_t taken, word_t* taken_blk);
+void* coalesce(arena_t* a, word_t* to_free);
+void releaseBlock(arena_t* a, word_t* blk);
+word_t* mapBlock(size_t newsize, size_t align);
+void* mappedChunk(word_t* blk);
+void* remapBlock(void* ptr, size_t size);
+void splice(arena_t* a, word_t* head);  /*reconnect the predecessor and the successor of a block*/
+void insertFreeBlock(arena_t* a, int bin, word_t* head);
 int findBin(size_t size);
+void treeInsert(word_t* link, word_t* node);
+void treeRemove(arena_t* a, word_t* node);
+word_t* treeFit(arena_t* a, size_t newsize);
+size_t largestFree(arena_t* a);
+int checkArena(arena_t* a);
+int checkTouched(arena_t* a);
+int checkBlock(arena_t* a, word_t* blk);
+size_t adjustSize(size_t size);
+word_t* findFit(arena_t* a, size_t newsize);
+word_t* extendHeap(arena_t* a, size_t size);
+word_t* growBlock(arena_t* a, word_t* blk, size_t newsize, size_t target);
+void shrinkBlock(arena_t* a, word_t* blk, size_t newsize);
+void* reallocBlock(void* ptr, size_t size, size_t expected);
+grower_t* findGrower(arena_t* a, word_t* blk);
+void trackGrower(arena_t* a, word_t* blk, size_t used, size_t hint, unsigned int grows);
+void forgetGrower(arena_t* a, word_t* blk);
+int reclaimSlack(arena_t* a);
+word_t* allocBlock(arena_t* a, size_t newsize);
+word_t* allocFound(arena_t* a, word_t* blk, size_t newsize);
+size_t allocBatch(arena_t* a, size_t newsize, size_t n, void** out);
+size_t carveBlocks(arena_t* a, word_t* blk, size_t newsize, size_t n, void** out);
+word_t* allocAligned(arena_t* a, size_t newsize, size_t align, size_t skew);
+size_t alignLead(word_t* blk, size_t align, size_t skew);
+word_t* alignedFit(arena_t* a, size_t newsize, size_t align, size_t skew);
+tcache_t* threadCache(void);
+void* refillCache(tcache_t* tc, int idx, size_t newsize);
+void* refillFrom(tcache_t* tc, arena_t* a, int idx, size_t newsize);
+void flushCache(tcache_t* tc, int idx, int n);
+int slabClass(size_t size){return (ALIGN(size) / ALIGNMENT) - 1;}
+int blockClass(size_t newsize){return SLAB_CLASSES + (newsize - TCACHE_MIN) / ALIGNMENT;}
+run_t* runOf(void* ptr);
+int initArena(arena_t* a);
+arena_t* takeArena(arena_t* a);
+arena_t* lockArena(tcache_t* tc);
+arena_t* nextArena(tcache_t* tc, arena_t* a);
+void pushRemote(arena_t* a, void* ptr);
+void drainRemote(arena_t* a);
+void freeLocked(arena_t* a, void* ptr);
+void freeForeign(arena_t* a, void* ptr);
+void lockDrained(arena_t* a);
+void drainIdle(arena_t* a);
+void* slabAlloc(arena_t* a, int cls);
+void slabFree(arena_t* a, void* obj);
+
+/*every field of mm_events_t is an unsigned long counter, so the structs add up word by word*/
+void addEvents(mm_events_t* sum, mm_events_t* events)
+{
+    unsigned long* dst = (unsigned long*)sum;
+    unsigned long* src = (unsigned long*)events;
+    for (size_t i = 0; i < sizeof(mm_events_t) / sizeof(unsigned long); i++)
+        dst[i] += src[i];
+}
 
 /*
- * mm_init - initialize the malloc package.
+ * mm_init - initialize the malloc package. The caller's arena is set up right away, the others on first
+ *     use; returns -1 if the heap cannot hold the caller's. Must not race with other calls into the package.
  */
 int mm_init(void)
 {
     mem_init();    
+    heap_base = mem_heap_lo();
+    heap_epoch++;
+    memset(runmap, 0, sizeof(runmap));
+#if MM_EVENTS
+    memset(&retired_events, 0, sizeof(retired_events));
+#endif
 
-    /*4 for head, foot, pred, succ of sentinel, 2 sentinels head and tail, BINCOUNT of those for BINCOUNT free lists, plus one for epilogue*/
-    mem_sbrk(MINBLOCKSIZE * 2 * BINCOUNT + SIZE_T_SIZE); 
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    arena_count = cpus < 1 ? 1 : (cpus > MEM_REGIONS ? MEM_REGIONS : (int)cpus);
+    for (int r = 0; r < MEM_REGIONS; r++)
+    {
+        memset(&arenas[r], 0, sizeof(arena_t));
+        pthread_mutex_init(&arenas[r].lock, NULL);
+        arenas[r].region = r;
+    }
+    return initArena(threadCache()->arena);    /*the caller's arena right away, so that a heap too small fails here*/
+}
+
+/*start the heap of arena a in its region; -1 if the region cannot even hold the bins. The caller holds
+the arena lock*/
+int initArena(arena_t* a)
+{
+    /*3 words of padding so that payloads after 4-byte headers are aligned, 4 words for head, foot, pred, succ
+    of sentinel, 2 sentinels head and tail, BINCOUNT of those for BINCOUNT free lists, plus one for epilogue*/
+    char* base = mem_region_sbrk(a->region, ARENA_OVERHEAD); 
+    if (base == (void*)-1)
+        return -1;
     
     /*initialize the epilogue block*/
-    size_t* epilogue = (size_t *)mem_heap_hi();
-    epilogue = (char *)(epilogue) + 1; 
-    epilogue = epilogue - 1;
-    *epilogue = 0x1;                /*epilogue is allocated with size 0*/
+    word_t* epilogue = (word_t *)(mem_region_hi(a->region) + 1) - 1;
+    *epilogue = ALLOCATED;          /*epilogue is allocated with size 0*/
 
     for(int i = 0; i < BINCOUNT; i++)
     {
         /*get sentinel head*/
-        bins[i] = ((size_t*) mem_heap_lo()) + (MINBLOCKSIZE * 2 * i) / SIZE_T_SIZE;  
+        a->bins[i] = (word_t*)(base + ALIGNMENT - WSIZE + MINBLOCKSIZE * 2 * i);  
         
         /*initialize sentinel head*/
-        setBlockSize(bins[i], MINBLOCKSIZE);  
-        setAllocStatus(bins[i], ALLOCATED);
-        setPred(bins[i], NULL);
-        setSucc(bins[i], nextBlock(bins[i]));
+        initBlock(a->bins[i], MINBLOCKSIZE, ALLOCATED);  
+        setAllocStatus(a->bins[i], ALLOCATED);
+        setPred(a->bins[i], NULL);
+        setSucc(a->bins[i], nextBlock(a->bins[i]));
 
         /*get sentinel tail*/
-        size_t* free_list_t = nextBlock(bins[i]);
+        word_t* free_list_t = nextBlock(a->bins[i]);
 
         /*initialize sentinel tail*/
-        setBlockSize(free_list_t, MINBLOCKSIZE); 
+        initBlock(free_list_t, MINBLOCKSIZE, ALLOCATED); 
         setAllocStatus(free_list_t, ALLOCATED);
-        setPred(free_list_t, bins[i]);
+        setPred(free_list_t, a->bins[i]);
         setSucc(free_list_t, NULL);
     }
+    a->ready = 1;
     return 0;
 }
 
+/*lock a, setting it up on first use and taking back what other threads freed into it; NULL, with
+nothing locked, if it cannot be set up*/
+arena_t* takeArena(arena_t* a)
+{
+    lockDrained(a);
+    if (!a->ready && initArena(a) < 0)
+    {
+        pthread_mutex_unlock(&a->lock);
+        return NULL;
+    }
+    return a;
+}
+
+/*lock the arena the calling thread allocates from, or if that one cannot be set up the next one in
+region order that can; NULL if none can*/
+arena_t* lockArena(tcache_t* tc)
+{
+    arena_t* a = tc->arena;
+    do
+    {
+        if (takeArena(a) != NULL)
+            return a;
+    } while ((a = &arenas[(a->region + 1) % MEM_REGIONS]) != tc->arena);
+    return NULL;
+}
+
+/*a, locked, cannot serve an allocation because its region is full: unlock it and lock the next arena
+in region order, so a thread that outgrows its own region spills into the others. NULL once the walk
+is back at the thread's own arena*/
+arena_t* nextArena(tcache_t* tc, arena_t* a)
+{
+    pthread_mutex_unlock(&a->lock);
+    while ((a = &arenas[(a->region + 1) % MEM_REGIONS]) != tc->arena)
+    {
+        if (takeArena(a) != NULL)
+            return a;
+    }
+    return NULL;
+}
+
+/*hand ptr, a slab object or block payload of arena a, back to a without taking its lock: push it on
+a's remote free list, a Treiber stack that only ever loses all of its entries at once*/
+void pushRemote(arena_t* a, void* ptr)
+{
+    void* head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+    do
+        *(void**)ptr = head;
+    while (!__atomic_compare_exchange_n(&a->remote, &head, ptr, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*lock a and free what other threads left on its remote free list, so that every path taking an arena's
+lock, not only allocation, gives those blocks back*/
+void lockDrained(arena_t* a)
+{
+    pthread_mutex_lock(&a->lock);
+    if (__atomic_load_n(&a->remote, __ATOMIC_RELAXED) != NULL)
+        drainRemote(a);
+}
+
+/*drain the remote free lists of the arenas other than a whose lock is free right now; run before the heap
+of a grows, so blocks freed into arenas nobody allocates from are not stranded. The caller holds a's lock,
+hence only trying the others*/
+void drainIdle(arena_t* a)
+{
+    for (int r = 0; r < MEM_REGIONS; r++)
+    {
+        arena_t* other = &arenas[r];
+        if (other != a && __atomic_load_n(&other->remote, __ATOMIC_RELAXED) != NULL
+            && pthread_mutex_trylock(&other->lock) == 0)
+        {
+            drainRemote(other);
+            pthread_mutex_unlock(&other->lock);
+        }
+    }
+}
+
+/*free everything on a's remote free list, detached as a whole with one exchange; the caller holds the
+arena lock*/
+void drainRemote(arena_t* a)
+{
+    void* ptr = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+    while (ptr != NULL)
+    {
+        void* next = *(void**)ptr;
+        freeLocked(a, ptr);
+        ptr = next;
+    }
+}
+
+/*free ptr, a slab object or block payload of arena a; the caller holds the arena lock*/
+void freeLocked(arena_t* a, void* ptr)
+{
+    if (runOf(ptr) != NULL)
+        slabFree(a, ptr);
+    else
+    {
+        forgetGrower(a, (word_t*)ptr - 1);
+        releaseBlock(a, (word_t*)ptr - 1);
+    }
+}
+
+/*free ptr, a slab object or block payload of arena a, which is not the calling thread's. If a's lock is
+free, as it always is for a single thread that spilled into a, ptr is freed right away so its memory can be
+coalesced and given back; only under contention does it go on a's remote free list*/
+void freeForeign(arena_t* a, void* ptr)
+{
+    if (pthread_mutex_trylock(&a->lock) != 0)
+    {
+        pushRemote(a, ptr);
+        return;
+    }
+    if (__atomic_load_n(&a->remote, __ATOMIC_RELAXED) != NULL)
+        drainRemote(a);
+    freeLocked(a, ptr);
+    pthread_mutex_unlock(&a->lock);
+}
+
 /*
- * mm_malloc - Allocate a block by incrementing the brk pointer.
+ * mm_malloc - Allocate a slab object for small requests and a block otherwise, from the calling
+ *     thread's cache when it holds one of the right class, else from the thread's arena under its lock.
  *     Always allocate a block whose size is a multiple of the alignment.
  */
 void *mm_malloc(size_t size)
 {
-    if(size == 0)        /*spurious requests*/
+    if(size == 0 || size > MAP_MAX)         /*spurious requests, or more than even a mapped block can hold*/
         return NULL; 
-    int newsize = ALIGN(size + SIZE_T_SIZE + SIZE_T_SIZE + SIZE_T_SIZE + SIZE_T_SIZE); /*align with header, footer, pred, succ*/
-    int starting_bin = findBin(newsize);                                /*the smallest bin that a search for free blocks starts from*/
+    size_t newsize = adjustSize(size);
+    int idx;
+    EVENT(mallocs, 1);
 
-    for (int b = starting_bin; b < BINCOUNT; b++)
+    if (size <= SLAB_MAX)
+        idx = slabClass(size);
+    else if (newsize <= TCACHE_MAX)
+        idx = blockClass(newsize);
+    else if (newsize >= mmap_threshold || newsize > MAX_HEAP)
     {
-        size_t* blk = bins[b]; 
-        while (!(endOfList(blk)) &&                                     /*boundary check*/
-            (allocStatus(blk) == ALLOCATED ||                           /*while not yet found a free block*/
-                blockSize(blk) < newsize))                              /*or block does not fit*/
-        {
-            blk = getSucc(blk);                                         /*get to next free block*/
-        }
-        
-        /*found a free large enough block*/
-        if (allocStatus(blk) == FREE && blockSize(blk) >= newsize) 
+        word_t* blk = mapBlock(newsize, ALIGNMENT);
+        return blk == NULL ? NULL : (void *)(blk + 1);
+    }
+    else
+    {
+        tcache_t* tc = threadCache();
+        word_t* blk = NULL;
+        for (arena_t* a = lockArena(tc); a != NULL; a = nextArena(tc, a))
         {
-            splice(blk);                                     /*take blk out of its free list, reconnecting its predecessor with its successor*/
-            allocSplit(blockSize(blk), newsize, blk);        /*allocate it and split if necessary*/
-            return (void *)((size_t*)blk + 1);               /*return start of payload*/
+            if ((blk = allocBlock(a, newsize)) != NULL)
+            {
+                pthread_mutex_unlock(&a->lock);
+                break;
+            }
         }
+        return blk == NULL ? NULL : (void *)(blk + 1);  /*return start of payload*/
     }
 
-    /*reaching here means there are no free blocks available, requesting more memory*/
-    void* new_mem = mem_sbrk(newsize); 
-    if (new_mem == (void*) - 1)                     /*memory request failed*/
-        return NULL;
-    else
+    tcache_t* tc = threadCache();
+    if (tc->count[idx] == 0)
     {
-        /*initialize the newly allocated memory*/
-        setBlockSize(new_mem, newsize);
-        setAllocStatus(new_mem, FREE);     
-        
-        /*new epilogue*/
-        *(nextBlock(new_mem)) = 0x1;
-        
-        new_mem = (size_t*) (coalesce(new_mem));                /*coalesce new free block with any adjacent free blocks*/
-        splice(new_mem);                                        /*take new_mem out of its free list, reconnecting its predecessor with its successor*/
-        allocSplit(blockSize(new_mem), newsize, new_mem);       /*allocate it and split if necessary*/
-        return (void *)((size_t*)(new_mem) + 1);                /*return start of payload*/
+        EVENT(cache_misses, 1);
+        return refillCache(tc, idx, newsize);
     }
+
+    EVENT(cache_hits, 1);
+    void* ptr = tc->head[idx];                          /*pop the most recently cached entry*/
+    tc->head[idx] = *(void**)ptr;
+    tc->count[idx]--;
+    return ptr;
 }
 
 
 /*
- * mm_free - Free a block and coalesce with any adjacent free blocks.
+ * mm_free - Unmap a mapped block, keep a slab object or small block in the thread cache, or free it in
+ *     the arena it came from and coalesce with any adjacent free blocks. Blocks of other arenas than the
+ *     caller's are freed by freeForeign, through their remote free list if that arena is busy.
  */
 void mm_free(void *ptr)
 {
-    size_t* blk = (char *)(ptr - SIZE_T_SIZE);  /*get the header*/
-    coalesce(blk);                              /*free and coalesce*/
+    word_t* blk = (word_t*)((char *)ptr - WSIZE);  /*get the header*/
+    EVENT(frees, 1);
+    if (isMapped(ptr))
+    {
+        mem_unmap(mappedChunk(blk));
+        return;
+    }
+
+    run_t* run = runOf(ptr);
+    size_t size;
+    int idx;
+
+    if (run != NULL)
+        idx = slabClass(run->objsize);
+    else if ((size = __atomic_load_n(blk, __ATOMIC_RELAXED) & ~0x7) <= TCACHE_MAX && size >= TCACHE_MIN)    /*see setAllocStatus*/
+        idx = blockClass(size);
+    else
+    {
+        arena_t* a = arenaOf(ptr);
+        if (a != threadCache()->arena)
+        {
+            freeForeign(a, ptr);
+            return;
+        }
+        lockDrained(a);
+        forgetGrower(a, blk);
+        releaseBlock(a, blk);                          /*free and coalesce*/
+        pthread_mutex_unlock(&a->lock);
+        return;
+    }
+
+    tcache_t* tc = threadCache();
+    if (tc->count[idx] == TCACHE_FILL)
+        flushCache(tc, idx, TCACHE_BATCH);          /*make room by returning a batch to the heap*/
+    *(void**)ptr = tc->head[idx];
+    tc->head[idx] = ptr;
+    tc->count[idx]++;
 }
 
 /*
- * mm_realloc - Implemented in terms of mm_malloc and mm_free. 
-Support three cases:
-1. Block shrinks
-2. Block gets bigger and there is adjacent free memory to contain it.
-3. Other cases: malloc a new block, copy current block to new block, and free the current block.
+ * mm_realloc - A mapped block is resized by remapBlock. A slab object keeps its place while the new size
+ * still fits its class and otherwise moves to a fresh allocation. Blocks are resized in their arena
+ * by reallocBlock.
  */
 void *mm_realloc(void *ptr, size_t size)
 {
+    EVENT(reallocs, 1);
     if (ptr == NULL)                /*realloc a NULL block is equivalent to malloc a new block*/
         return mm_malloc(size);
         
@@ -210,258 +669,1556 @@ void *mm_realloc(void *ptr, size_t size)
         return (void *)NULL;
     }
 
-    size_t newsize = ALIGN(size + SIZE_T_SIZE + SIZE_T_SIZE + SIZE_T_SIZE + SIZE_T_SIZE);
-    size_t* blk = (size_t*)(ptr - SIZE_T_SIZE);
+    if (isMapped(ptr))
+        return remapBlock(ptr, size);
 
-    if (blockSize(blk) < newsize)
+    run_t* run = runOf(ptr);
+    if (run != NULL)
     {
-        /*if next free block (if any) enough to hold newsize -> realloc in place*/
-        if (allocStatus(nextBlock(blk)) == FREE && blockSize(blk) + blockSize(nextBlock(blk)) >= newsize)
-        {
-            size_t* next_block_head = nextBlock(blk);
-            size_t merged_block_size = blockSize(blk) + blockSize(next_block_head);
-
-            /*splice free next block*/
-            splice(next_block_head);
-            
-            /*change the block size accordingly and split it if necessary*/
-            setBlockSize(blk, merged_block_size); 
-            setAllocStatus(blk, ALLOCATED);
-            allocSplit(merged_block_size, newsize, blk);
+        if (size <= run->objsize)
             return ptr;
-        }
-
-        /*malloc a new block, copy current block to this new block, and free current block*/
-        else
+        void* new_ptr = mm_malloc(size);
+        if (new_ptr != NULL)
         {
-            void* new_block = mm_malloc(newsize);
-            memcpy(new_block, ptr, blockSize(blk) - SIZE_T_SIZE - SIZE_T_SIZE );  /*copy the payload only, exclude header & footer*/
+            memcpy(new_ptr, ptr, run->objsize);
             mm_free(ptr);
-            return new_block;
         }
+        return new_ptr;
     }
 
-    /*block shrinks -> free the remaining memory; only split if remaining is at least MINBLOCKSIZE */
-    else if (blockSize(blk) > newsize && blockSize(blk) - newsize >= MINBLOCKSIZE)
-    {
-        size_t remaining_size = blockSize(blk) - newsize;
+    return reallocBlock(ptr, size, 0);
+}
 
-        /*change current block's size to newsize*/  
-        setBlockSize(blk, newsize);
-        setAllocStatus(blk, ALLOCATED);
-    
-        size_t* remaining_block = nextBlock(blk);
+/*
+ * mm_realloc_hint - mm_realloc for a block the caller expects to keep growing up to expected bytes: the
+ *     first time it has to move, room for all of them is reserved at once. Hints for blocks that fit in
+ *     the thread caches are ignored.
+ */
+void *mm_realloc_hint(void *ptr, size_t size, size_t expected)
+{
+    if (ptr == NULL || size == 0 || isMapped(ptr) || runOf(ptr) != NULL)
+        return mm_realloc(ptr, size);
+    return reallocBlock(ptr, size, expected);
+}
 
-        /*set remaining block's size and coalesce it*/
-        setBlockSize(remaining_block, remaining_size);
-        setAllocStatus(remaining_block, FREE);
-        coalesce(remaining_block);
-        return ptr; 
+/*
+ * mm_memalign - Allocate a block whose payload address is a multiple of alignment, a power of two. Alignments
+ *     the package gives every block anyway are left to mm_malloc. Larger ones carve the block out of a free
+ *     block of the calling thread's arena with allocAligned, giving what is cut off on either side back
+ *     to the bins; blocks that would be mapped, or alignments that large, get a chunk mapped for them.
+ */
+void* mm_memalign(size_t alignment, size_t size)
+{
+    if (alignment <= ALIGNMENT)
+        return mm_malloc(size);
+    if (size == 0 || size > MAP_MAX || alignment > MAX_HEAP || (alignment & (alignment - 1)) != 0)
+        return NULL;
+
+    size_t newsize = adjustSize(size);
+    word_t* blk;
+    if (newsize >= mmap_threshold || newsize > MAX_HEAP || alignment >= mmap_threshold)
+        blk = mapBlock(newsize, alignment);
+    else
+    {
+        /*allocAligned aligns payloads relative to heap_base, so skew by however far heap_base is off*/
+        size_t skew = (size_t)(-(uintptr_t)heap_base) & (alignment - 1);
+        tcache_t* tc = threadCache();
+        blk = NULL;
+        for (arena_t* a = lockArena(tc); a != NULL; a = nextArena(tc, a))
+        {
+            if ((blk = allocAligned(a, newsize, alignment, skew)) != NULL)
+            {
+                pthread_mutex_unlock(&a->lock);
+                break;
+            }
+        }
     }
-    return ptr;
+    return blk == NULL ? NULL : (void *)(blk + 1);
 }
 
-/*this function checks if a block can be splitted, set the headers and footers of the blocks,
-return the free block to its appropriate free list, and mark the allocated block*/
-void allocSplit(size_t total, size_t taken, size_t* taken_blk)
-/*block @ taken_blk will be allocated with size taken and any leftover will be free block*/
+/*
+ * mm_usable_size - The bytes the caller may use at ptr, which may exceed what it asked for. A block with
+ *     realloc slack stops being tracked as a grower, so the slack is never taken back from under the caller.
+ */
+size_t mm_usable_size(void* ptr)
 {
-    if (total > taken && total - taken >= MINBLOCKSIZE)
-    {
-        setBlockSize(taken_blk, taken);
+    if (ptr == NULL)
+        return 0;
+    word_t* blk = (word_t*)ptr - 1;
+    if (isMapped(ptr))
+        return blockSize(blk) - WSIZE - WSIZE;      /*the chunk's padding word and header*/
 
-        /*set fields for the remaining memory*/
-        size_t* remains_blk = nextBlock(taken_blk);
-        setBlockSize(remains_blk, total - taken);
-        setAllocStatus(remains_blk, FREE);
-        
-        /*coalesce remaining memory with any adjacent free block*/
-        setAllocStatus(taken_blk, ALLOCATED);
-        coalesce(remains_blk);
+    run_t* run = runOf(ptr);
+    if (run != NULL)
+        return run->objsize;
+
+    size_t size = __atomic_load_n(blk, __ATOMIC_RELAXED) & ~0x7;
+    if (size > TCACHE_MAX)
+    {
+        arena_t* a = arenaOf(ptr);
+        lockDrained(a);
+        forgetGrower(a, blk);
+        size = blockSize(blk);
+        pthread_mutex_unlock(&a->lock);
     }
-    setAllocStatus(taken_blk, ALLOCATED);  /*mark taken_blk as ALLOCATED*/
+    return size - WSIZE;
 }
 
-void* coalesce(size_t* to_free)
-{    
-    /*previous and next both allocated, simply reset allocate bit*/
-    if(allocStatus(nextBlock(to_free)) == ALLOCATED && allocStatus(to_free - 1) == ALLOCATED)
-    {
-        setAllocStatus(to_free, FREE);
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes into out and return how many were allocated, fewer
+ *     than n only when memory runs out. Entries cached by the calling thread are handed out first; the
+ *     rest are taken under a single lock, slab objects from runs and blocks carved back to back out of
+ *     as few free blocks as possible, growing the heap at most once for all that do not fit.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void** out)
+{
+    if (size == 0 || size > MAP_MAX || n == 0)
+        return 0;
+    size_t newsize = adjustSize(size);
+    size_t done = 0;
 
-        /*add free block to head of free list*/
-        size_t* free_list_h = bins[findBin(blockSize(to_free))];
-        insertFreeBlock(free_list_h, to_free);
-        return (void*) to_free;
+    if (newsize >= mmap_threshold || newsize > MAX_HEAP)    /*each gets a chunk of its own, nothing to share*/
+    {
+        for (word_t* blk; done < n && (blk = mapBlock(newsize, ALIGNMENT)) != NULL; done++)
+            out[done] = blk + 1;
+        EVENT(mallocs, done);
+        return done;
     }
 
-    /*next block free, previous block allocated*/
-    else if (allocStatus(nextBlock(to_free)) == FREE && allocStatus(to_free - 1) == ALLOCATED)
+    tcache_t* tc = threadCache();
+    int idx = -1;
+    if (size <= SLAB_MAX)
+        idx = slabClass(size);
+    else if (newsize <= TCACHE_MAX)
+        idx = blockClass(newsize);
+    for (; idx >= 0 && done < n && tc->count[idx] > 0; done++)
     {
-        /*splice free next block*/
-        size_t* next_block_head = nextBlock(to_free);
-        splice(next_block_head);
-
-        /*change to total size*/
-        setBlockSize(to_free, blockSize(to_free) + blockSize(next_block_head));
-        setAllocStatus(to_free, FREE);
-
-        /*add free block to head of free list*/
-        size_t* free_list_h = bins[findBin(blockSize(to_free))];
-        insertFreeBlock(free_list_h, to_free);
-        return (void*) to_free;
+        out[done] = tc->head[idx];
+        tc->head[idx] = *(void**)out[done];
+        tc->count[idx]--;
     }
+    EVENT(cache_hits, done);
 
-    /*previous block free, next block allocated*/
-    else if (allocStatus(nextBlock(to_free)) == ALLOCATED && allocStatus(to_free - 1) == FREE)
+    for (arena_t* a = done < n ? lockArena(tc) : NULL; a != NULL; a = nextArena(tc, a))
     {
-        /*splice free prev block*/
-        size_t *prev_block_head = prevBlock(to_free);
-        splice(prev_block_head);
+        if (size <= SLAB_MAX)
+            for (; done < n && (out[done] = slabAlloc(a, idx)) != NULL; done++);
+        else
+            done += allocBatch(a, newsize, n - done, out + done);
+        if (done == n)
+        {
+            pthread_mutex_unlock(&a->lock);
+            break;
+        }
+    }
+    EVENT(mallocs, done);
+    return done;
+}
 
-        /*change to total size*/
-        setBlockSize(prev_block_head, blockSize(prev_block_head) + blockSize(to_free));
-        setAllocStatus(prev_block_head, FREE);
+static int byAddress(const void* x, const void* y)
+{
+    uintptr_t p = (uintptr_t)*(void* const*)x, q = (uintptr_t)*(void* const*)y;
+    return (p > q) - (p < q);
+}
 
-        /*add free block to head of free list*/
-        size_t* free_list_h = bins[findBin(blockSize(prev_block_head))];
-        insertFreeBlock(free_list_h, prev_block_head);
-        return (void*) prev_block_head;
+/*sort ptrs by address: insertion sort for batches of up to SORT_INSERTION entries, which mostly come in
+order already, or in reverse order when they were handed out LIFO and are reversed first; qsort otherwise*/
+void sortByAddress(void** ptrs, size_t n)
+{
+    if (n > SORT_INSERTION)
+    {
+        qsort(ptrs, n, sizeof(void*), byAddress);
+        return;
     }
+    if (n > 1 && (uintptr_t)ptrs[0] > (uintptr_t)ptrs[n - 1])
+        for (size_t i = 0, j = n - 1; i < j; i++, j--)
+        {
+            void* ptr = ptrs[i];
+            ptrs[i] = ptrs[j];
+            ptrs[j] = ptr;
+        }
+    for (size_t i = 1; i < n; i++)
+    {
+        void* ptr = ptrs[i];
+        size_t j = i;
+        for (; j > 0 && (uintptr_t)ptrs[j - 1] > (uintptr_t)ptr; j--)
+            ptrs[j] = ptrs[j - 1];
+        ptrs[j] = ptr;
+    }
+}
 
-    /*previous and next free*/
-    else
-    {        
-        /*splice free prev block*/
-        size_t* prev_block_head = prevBlock(to_free);
-        splice(prev_block_head);
-
-        /*splice free next block*/
-        size_t* next_block_head = nextBlock(to_free);
-        splice(next_block_head);
+/*
+ * mm_free_batch - Free the n blocks at ptrs, skipping NULL entries; ptrs is left sorted by address. Blocks
+ *     of the caller's arena are freed under a single lock, bypassing the thread cache: every run of blocks
+ *     that lie back to back becomes one block first, so the run is coalesced with its neighbours once.
+ *     Blocks of other arenas go to freeForeign and mapped blocks are unmapped, as in mm_free.
+ */
+void mm_free_batch(void** ptrs, size_t n)
+{
+    sortByAddress(ptrs, n);
+    arena_t* a = threadCache()->arena;
+    int locked = 0;
 
-        /*change to total size*/
-        setBlockSize(prev_block_head, blockSize(prev_block_head) + blockSize(to_free) + blockSize(next_block_head));
-        setAllocStatus(prev_block_head, FREE);
+    for (size_t i = 0; i < n; i++)
+    {
+        void* ptr = ptrs[i];
+        if (ptr == NULL)
+            continue;
+        EVENT(frees, 1);
+        if (isMapped(ptr))
+        {
+            mem_unmap(mappedChunk((word_t*)ptr - 1));
+            continue;
+        }
+        if (arenaOf(ptr) != a)
+        {
+            freeForeign(arenaOf(ptr), ptr);
+            continue;
+        }
+        if (!locked)
+        {
+            lockDrained(a);
+            locked = 1;
+        }
+        if (runOf(ptr) != NULL)
+        {
+            slabFree(a, ptr);
+            continue;
+        }
 
-        /*add free block to head of free list*/
-        size_t* free_list_h = bins[findBin(blockSize(prev_block_head))];
-        insertFreeBlock(free_list_h, prev_block_head);
-        return (void*) prev_block_head;
+        /*absorb the blocks freed along with blk that follow it directly; no slab object can, as a run's
+        payload starts with the run_t*/
+        word_t* blk = (word_t*)ptr - 1;
+        size_t size = blockSize(blk);
+        forgetGrower(a, blk);
+        while (i + 1 < n && (word_t*)ptrs[i + 1] - 1 == blk + size / WSIZE)
+        {
+            word_t* next = (word_t*)ptrs[++i] - 1;
+            forgetGrower(a, next);
+            size += blockSize(next);
+        }
+        if (size != blockSize(blk))
+            setBlockSize(blk, size);
+        releaseBlock(a, blk);                          /*free and coalesce*/
     }
+    if (locked)
+        pthread_mutex_unlock(&a->lock);
 }
 
-void insertFreeBlock(size_t* free_list, size_t* block)
+/*
+ * mm_stats - Sample the state of the heap into stats: free blocks and bytes per bin, summed over the arenas,
+ *     along with the fit searches so far. Each arena is locked only while its counters are read, and the
+ *     largest free block is found in at most one bin per arena, so this is cheap enough to call often.
+ *     Blocks in thread caches and slab runs count as live.
+ */
+void mm_stats(mm_stats_t* stats)
 {
-    size_t* cur_first_block = getSucc(free_list);
-    setSucc(block, cur_first_block);
-    setPred(cur_first_block, block);
-    setSucc(free_list, block);
-    setPred(block, free_list);
+    memset(stats, 0, sizeof(mm_stats_t));
+    for (int r = 0; r < MEM_REGIONS; r++)
+    {
+        arena_t* a = &arenas[r];
+        lockDrained(a);
+        if (a->ready)
+        {
+            size_t region_size = (char*)mem_region_hi(r) + 1 - (heap_base + (size_t)r * MAX_HEAP);
+            size_t free_bytes = 0;
+            for (int bin = 0; bin <= TREE_BIN; bin++)
+            {
+                stats->bin_blocks[bin] += a->bin_blocks[bin];
+                stats->bin_bytes[bin] += a->bin_bytes[bin];
+                stats->free_blocks += a->bin_blocks[bin];
+                free_bytes += a->bin_bytes[bin];
+            }
+            size_t largest = largestFree(a);
+            if (largest > stats->largest_free)
+                stats->largest_free = largest;
+            stats->free_bytes += free_bytes;
+            stats->live_bytes += region_size - ARENA_OVERHEAD - free_bytes;
+            stats->searches += a->searches;
+            stats->search_steps += a->search_steps;
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+    stats->mapped_bytes = mem_mapsize();
+    stats->heap_size = mem_heapsize();
+    if (stats->free_bytes != 0)
+        stats->fragmentation = 1.0 - (double)stats->largest_free / stats->free_bytes;
 }
 
-void splice(size_t* block)
+/*
+ * mm_events - Add up into events what the calling thread and every thread that has exited counted since
+ *     mm_init, and return 1; return 0 with events cleared if the package was built without MM_EVENTS.
+ */
+int mm_events(mm_events_t* events)
 {
-    size_t* pred = getPred(block);
-    size_t* succ = getSucc(block);
-    setSucc(pred, succ);
-    setPred(succ, pred);
+    memset(events, 0, sizeof(mm_events_t));
+#if MM_EVENTS
+    pthread_mutex_lock(&retired_lock);
+    addEvents(events, &retired_events);
+    pthread_mutex_unlock(&retired_lock);
+    if (tcache.epoch == heap_epoch)
+        addEvents(events, &tcache.events);
+    return 1;
+#else
+    return 0;
+#endif
 }
 
-int findBin(size_t size)
+/*
+ * mm_check - Check the heap for consistency and return the number of problems found, each reported on
+ *     stderr. A full check (incremental 0) walks every block of every arena, every bin and the treap:
+ *     headers must agree with footers and with the prev-alloc bit of the next block, no two free blocks
+ *     may be adjacent, every free block must sit in the bin findBin gives for it, list links must be
+ *     symmetric and the treap ordered, and the bins must hold exactly the free blocks of the heap.
+ *     An incremental check (incremental 1) checks only blocks whose header changed since the last check,
+ *     with their links and neighbours, if mm.c was built with MM_CHECK and no more than CHECK_LOG blocks
+ *     of an arena changed; otherwise it is a full check. Blocks in thread caches count as allocated.
+ */
+int mm_check(int incremental)
 {
-    if (size <= 16) return 0;
-    if (size <= 32) return 1;
-    if (size <= 64) return 2;
-    if (size <= 128) return 3;
-    if (size <= 256) return 4;
-    if (size <= 512) return 5;
-    if (size <= 1024) return 6;
-    if (size <= 2048) return 7;
-    if (size <= 4096) return 8;
-    if (size <= 8192) return 9;
-    if (size <= 16384) return 10;
-    if (size <= 32768) return 11;
-    if (size <= 65536) return 12;
-    if (size <= 131072) return 13;
-    if (size <= 262144) return 14;
-    if (size <= 524288) return 15;
-    if (size <= 1048576) return 16;
-    if (size <= 2097152) return 17;
-    if (size <= 4194304) return 18;
-    return 19;  // fallback bin for very large blocks
-}
-
-void print_free_list(size_t* free_list_h)
-{
-    size_t* ptr = free_list_h;
-    while (!endOfList(ptr))
+    int errors = 0;
+    for (int r = 0; r < MEM_REGIONS; r++)
     {
-        printf("%d -> ",ptr);
-        ptr = getSucc(ptr);
+        arena_t* a = &arenas[r];
+        lockDrained(a);
+        if (a->ready)
+        {
+#if MM_CHECK
+            if (incremental && a->touched_count <= CHECK_LOG)
+                errors += checkTouched(a);
+            else
+                errors += checkArena(a);
+            a->touched_count = 0;
+#else
+            errors += checkArena(a);
+#endif
+        }
+        pthread_mutex_unlock(&a->lock);
     }
-    printf("EOL\n");
+    return errors;
 }
 
-/*MALLOC-SPLIT FOR ADDRESS-ORDERED FREE LIST*/
-/*size_t* prev_free = getPred(taken_blk);
-size_t* next_free = getSucc(taken_blk);
-setSucc(prev_free, remains_blk);            
-setPred(remains_blk, prev_free);
-if(!atEpilogue(next_free))
-    setPred(next_free, remains_blk);
-setSucc(remains_blk, next_free);*/
+/*mm_realloc for a block of the heap, expecting it to reach expected bytes unless that is 0:
+1. Block shrinks: the tail is freed.
+2. Block gets bigger within the slack it already has: nothing moves.
+3. Block gets bigger: growBlock absorbs free neighbours or extends the heap to grow it in place.
+4. Other cases: allocate a new block (mapped once the new size reaches mmap_threshold), copy current
+   block to new block, and free the current block.
+Blocks growing past TCACHE_MAX are tracked as growers; from their second growth on, or right away given
+a hint, any move reserves slack beyond newsize*/
+void* reallocBlock(void* ptr, size_t size, size_t expected)
+{
+    if (size > MAP_MAX)
+        return NULL;
+    size_t newsize = adjustSize(size);
+    word_t* blk = (word_t*)((char *)ptr - WSIZE);
+    void* result = ptr;
 
+    arena_t* a = arenaOf(ptr);
+    lockDrained(a);
+    grower_t* g = findGrower(a, blk);
+    size_t hint = expected > newsize && expected <= MAX_HEAP ? adjustSize(expected) : (g != NULL ? g->hint : 0);
+    unsigned int grows = g != NULL ? g->grows : 0;
 
-/*OPTIMIZATION FOR REALLOC WHICH CONSIDERS PREV BLOCK AS WELL*/
+    if (g != NULL && newsize >= g->used && newsize <= blockSize(blk))
+    {
+        g->used = newsize;
+        g->hint = hint;
+        g->stamp = ++a->grower_clock;
+    }
+    else if (blockSize(blk) < newsize)
+    {
+        /*the size to reserve when the payload has to move anyway*/
+        size_t target = newsize;
+        if (hint > newsize)
+            target = hint;
+        else if (grows > 0)
+            target = ALIGN(newsize + newsize / 2);
+        if (newsize <= TCACHE_MAX || target >= mmap_threshold || target > MAX_HEAP)
+            target = newsize;
 
-/*next block allocated, but prev block is free and can accommodate*/
-/*else if( (allocStatus(nextBlock(p)) == ALLOCATED)
-        && ((allocStatus(p-1) == FREE) && ((blockSize(p) + blockSize(p-1)) >= newsize)) )
-{ 
-    printf("case 2\n");
-    
-    size_t *prev_block_head = prevBlock(p);
-    size_t* prev_blk_head_pred = getPred(prev_block_head);
-    size_t* prev_blk_head_succ = getSucc(prev_block_head);
-    size_t merged_block_size = blockSize(p) + blockSize(prev_block_head);
-
-    setSucc(prev_blk_head_pred, prev_blk_head_succ);
-    if(!atEpilogue(prev_blk_head_succ))
-        setPred(prev_blk_head_succ, prev_blk_head_pred);
-
-    setBlockSize(prev_block_head, merged_block_size);
-    setAllocStatus(prev_block_head, FREE);
-    int splitted = split(merged_block_size, newsize, prev_block_head);
-    memcpy((prev_block_head + 1), ptr, blockSize(p) - SIZE_T_SIZE - SIZE_T_SIZE);
-    printf("splitted: %d\n", splitted);
-    setAllocStatus(prev_block_head, ALLOCATED);
-    return (prev_block_head + 1);
-
-}*/
-
-/*next block free but combined size cannot accomodate, check if prev block free and if adding its size can accommodate*/
-/*else if ( (blockSize(p) + blockSize(nextBlock(p)) < newsize)
-        && (allocStatus(p-1) == FREE && (blockSize(p-1) + blockSize(p) + blockSize(nextBlock(p))) >= newsize))
-{
-    printf("case 3\n");
-
-    size_t merged_block_size = blockSize(p-1) + blockSize(p) + blockSize(nextBlock(p));
-    size_t *prev_block_head = prevBlock(p);
-    size_t *next_block_head = nextBlock(p);
-
-    setSucc(getPred(prev_block_head), getSucc(prev_block_head));
-    if(!atEpilogue(getSucc(prev_block_head)))
-        setPred(getSucc(prev_block_head), getPred(prev_block_head));
-    
-    setSucc(getPred(next_block_head), getSucc(next_block_head));
-    if(!atEpilogue(getSucc(next_block_head)))
-        setPred(getSucc(next_block_head), getPred(next_block_head));
+        word_t* grown = newsize <= MAX_HEAP ? growBlock(a, blk, newsize, target) : NULL;
 
-    setBlockSize(prev_block_head, merged_block_size);
-    int splitted = split(merged_block_size, newsize, prev_block_head);
-    memcpy(prev_block_head + 1, ptr, blockSize(p) - SIZE_T_SIZE - SIZE_T_SIZE);
+        /*allocate a new block, copy current block to this new block, and free current block*/
+        if (grown == NULL)
+        {
+            if (newsize >= mmap_threshold || newsize > MAX_HEAP)
+                grown = mapBlock(newsize, ALIGNMENT);
+            else if ((grown = allocBlock(a, target)) == NULL && target > newsize)
+                grown = allocBlock(a, newsize);
+            if (grown != NULL)
+            {
+                memcpy(grown + 1, ptr, blockSize(blk) - WSIZE);  /*copy the payload only, exclude header*/
+                releaseBlock(a, blk);
+            }
+        }
+
+        if (grown == NULL && newsize < mmap_threshold && newsize <= MAX_HEAP)
+        {
+            /*a's region is full: mm_malloc spills into another arena, which must not be locked under a*/
+            size_t copy = blockSize(blk) - WSIZE;
+            forgetGrower(a, blk);
+            pthread_mutex_unlock(&a->lock);
+            if ((result = mm_malloc(size)) != NULL)
+            {
+                memcpy(result, ptr, copy);
+                mm_free(ptr);
+            }
+            return result;
+        }
 
-    setAllocStatus(prev_block_head, ALLOCATED);
-    return (prev_block_head + 1);
-}*/
+        if (grown == NULL)
+            result = NULL;
+        else
+        {
+            forgetGrower(a, blk);
+            if (newsize > TCACHE_MAX && !isMapped(grown + 1))
+                trackGrower(a, grown, newsize, hint, grows + 1);
+            result = grown + 1;
+        }
+    }
+    else
+    {
+        forgetGrower(a, blk);
+        shrinkBlock(a, blk, newsize);
+    }
+    pthread_mutex_unlock(&a->lock);
+    return result;
+}
+
+/*free the tail of blk past newsize, if it is at least MINBLOCKSIZE; the caller holds the arena lock*/
+void shrinkBlock(arena_t* a, word_t* blk, size_t newsize)
+{
+    if (blockSize(blk) > newsize && blockSize(blk) - newsize >= MINBLOCKSIZE)
+    {
+        size_t remaining_size = blockSize(blk) - newsize;
+
+        /*change current block's size to newsize*/  
+        setBlockSize(blk, newsize);
+    
+        word_t* remaining_block = nextBlock(blk);
+
+        /*set remaining block's size and coalesce it*/
+        initBlock(remaining_block, remaining_size, ALLOCATED);
+        releaseBlock(a, remaining_block);
+    }
+}
+
+/*the grower slot tracking blk, NULL if there is none; the caller holds the arena lock*/
+grower_t* findGrower(arena_t* a, word_t* blk)
+{
+    for (int i = 0; a->grower_count > 0 && i < GROWER_SLOTS; i++)
+        if (a->growers[i].blk == blk)
+            return &a->growers[i];
+    return NULL;
+}
+
+/*track blk as a grower, taking a free slot or else the stalest one, whose slack is given back first;
+the caller holds the arena lock*/
+void trackGrower(arena_t* a, word_t* blk, size_t used, size_t hint, unsigned int grows)
+{
+    grower_t* g = &a->growers[0];
+    for (int i = 0; i < GROWER_SLOTS && g->blk != NULL; i++)
+        if (a->growers[i].blk == NULL || a->growers[i].stamp < g->stamp)
+            g = &a->growers[i];
+
+    if (g->blk != NULL)
+        shrinkBlock(a, g->blk, g->used);
+    else
+        a->grower_count++;
+    g->blk = blk;
+    g->used = used;
+    g->hint = hint;
+    g->grows = grows;
+    g->stamp = ++a->grower_clock;
+}
+
+/*stop tracking blk, which is about to be freed or to stop growing; the caller holds the arena lock*/
+void forgetGrower(arena_t* a, word_t* blk)
+{
+    grower_t* g = findGrower(a, blk);
+    if (g != NULL)
+    {
+        g->blk = NULL;
+        a->grower_count--;
+    }
+}
+
+/*give the slack of every grower back to the bins, still tracking the blocks; returns whether any block
+shrank. The caller holds the arena lock*/
+int reclaimSlack(arena_t* a)
+{
+    int reclaimed = 0;
+    for (int i = 0; a->grower_count > 0 && i < GROWER_SLOTS; i++)
+        if (a->growers[i].blk != NULL && blockSize(a->growers[i].blk) - a->growers[i].used >= MINBLOCKSIZE)
+        {
+            shrinkBlock(a, a->growers[i].blk, a->growers[i].used);
+            reclaimed = 1;
+        }
+    return reclaimed;
+}
+
+/*grow the allocated blk to newsize without copying its payload elsewhere: into a free next block, by
+extending the heap when blk ends it (possibly behind a free next block), or into a free previous block
+and perhaps the next one too. Absorbed neighbours supply up to target bytes, leaving slack for the next
+growth. Returns the block now holding the payload, which starts earlier when the previous block was
+absorbed, or NULL if blk cannot grow where it is; the caller holds the arena lock*/
+word_t* growBlock(arena_t* a, word_t* blk, size_t newsize, size_t target)
+{
+    word_t* next = nextBlock(blk);
+    size_t next_size = allocStatus(next) == FREE ? blockSize(next) : 0;
+    word_t* prev = prevAllocStatus(blk) == FREE ? prevBlock(blk) : NULL;
+    size_t prev_size = prev != NULL ? blockSize(prev) : 0;
+    size_t total = blockSize(blk) + next_size;
+
+    /*blk ends the heap: ask for just what is missing, the old epilogue becomes part of blk*/
+    if (total < newsize && atEpilogue(next + next_size / WSIZE))
+    {
+        if (mem_region_sbrk(a->region, newsize - total) == (void*) - 1)
+            return NULL;
+        EVENT(extends, 1);
+        EVENT(extend_bytes, newsize - total);
+        PROBE2(extend, a->region, newsize - total);
+        *(blk + newsize / WSIZE) = ALLOCATED;          /*new epilogue, its prev-alloc bit is set by allocSplit*/
+        total = newsize;
+    }
+
+    if (total >= newsize)
+    {
+        if (next_size != 0)
+            splice(a, next);
+        setBlockSize(blk, total);
+        allocSplit(a, total, total < target ? total : target, blk);
+        return blk;
+    }
+
+    if (prev_size + total < newsize)
+        return NULL;
+
+    /*take the neighbours out of their bins before their link words get overwritten*/
+    splice(a, prev);
+    if (next_size != 0)
+        splice(a, next);
+    memmove(prev + 1, blk + 1, blockSize(blk) - WSIZE);
+    total += prev_size;
+    setBlockSize(prev, total);
+    allocSplit(a, total, total < target ? total : target, prev);
+    return prev;
+}
+
+/*a free block for newsize, NULL if none is large enough: first fit among the list bins, best fit
+in the treap; the caller holds the arena lock*/
+word_t* findFit(arena_t* a, size_t newsize)
+{
+    int starting_bin = findBin(newsize);                /*the smallest bin that a search for free blocks starts from*/
+    a->searches++;
+    EVENT(searches, 1);
+    PROBE1(search, newsize);
+
+    if (starting_bin < TREE_BIN)
+    {
+        /*blocks in the starting bin may be smaller than newsize, so first fit through it*/
+        word_t* blk = getSucc(a->bins[starting_bin]);
+        while (!endOfList(blk) && blockSize(blk) < newsize)
+        {
+            blk = getSucc(blk);
+            a->search_steps++;
+            EVENT(search_steps, 1);
+        }
+        if (!endOfList(blk))
+            return blk;
+
+        /*every block of a larger bin fits, so take the head of the smallest non-empty one*/
+        unsigned int larger_bins = a->binmap & ~((2u << starting_bin) - 1);
+        if (larger_bins == 0)
+            return NULL;
+        if (__builtin_ctz(larger_bins) < TREE_BIN)
+            return getSucc(a->bins[__builtin_ctz(larger_bins)]);
+    }
+    return treeFit(a, newsize);
+}
+
+/*allocate a block of newsize from the bins, or from new heap memory if none fits; the caller holds the arena lock*/
+word_t* allocBlock(arena_t* a, size_t newsize)
+{
+    return allocFound(a, findFit(a, newsize), newsize);
+}
+
+/*allocBlock once findFit has searched the bins for newsize and returned blk: allocate blk, or if it is NULL
+search again after taking back the slack of growing blocks, and grow the heap if that fails too*/
+word_t* allocFound(arena_t* a, word_t* blk, size_t newsize)
+{
+    if (blk == NULL && reclaimSlack(a))                  /*memory is tight: take back the slack of growing blocks first*/
+        blk = findFit(a, newsize);
+
+    /*found a free large enough block*/
+    if (blk != NULL)
+    {
+        splice(a, blk);                                     /*take blk out of its free list, reconnecting its predecessor with its successor*/
+        allocSplit(a, blockSize(blk), newsize, blk);        /*allocate it and split if necessary*/
+        return blk;
+    }
+
+    /*reaching here means there are no free blocks available, requesting more memory*/
+    word_t* new_mem = extendHeap(a, newsize);
+    if (new_mem == NULL)                                    /*memory request failed*/
+        return NULL;
+    splice(a, new_mem);                                        /*take new_mem out of its free list, reconnecting its predecessor with its successor*/
+    allocSplit(a, blockSize(new_mem), newsize, new_mem);       /*allocate it and split if necessary*/
+    return new_mem;
+}
+
+/*allocate n blocks of newsize into out, carving as many as fit out of each free block found and growing the
+heap once for all that are still missing; returns how many were allocated. The caller holds the arena lock*/
+size_t allocBatch(arena_t* a, size_t newsize, size_t n, void** out)
+{
+    size_t done = 0;
+    int whole = 1;                                          /*whether a free block may still hold all that are missing*/
+    while (done < n)
+    {
+        size_t missing = n - done < MAX_HEAP / newsize ? n - done : MAX_HEAP / newsize;
+        word_t* blk = whole ? findFit(a, missing * newsize) : NULL;
+        if (blk == NULL)
+        {
+            whole = 0;                                      /*carving only makes free blocks smaller*/
+            blk = findFit(a, newsize);
+        }
+        if (blk == NULL && reclaimSlack(a))
+        {
+            whole = 1;
+            continue;
+        }
+        if (blk == NULL)
+            blk = extendHeap(a, missing * newsize);
+        if (blk == NULL)
+            blk = extendHeap(a, newsize);                   /*no room for all of them, maybe for one*/
+        if (blk == NULL)
+            break;
+        done += carveBlocks(a, blk, newsize, n - done, out + done);
+    }
+    return done;
+}
+
+/*allocate up to n blocks of newsize back to back from the front of the free block blk into out and return
+how many; what is left stays free. The caller holds the arena lock*/
+size_t carveBlocks(arena_t* a, word_t* blk, size_t newsize, size_t n, void** out)
+{
+    size_t total = blockSize(blk);
+    size_t count = total / newsize < n ? total / newsize : n;
+    int prev_alloc = prevAllocStatus(blk);
+    splice(a, blk);
+    for (size_t i = 1; i < count; i++)
+    {
+        initBlock(blk, newsize, prev_alloc);
+        *blk |= ALLOCATED;                                  /*the next header, written next, carries the prev-alloc bit*/
+        *out++ = blk + 1;
+        blk = nextBlock(blk);
+        total -= newsize;
+        prev_alloc = ALLOCATED;
+    }
+    initBlock(blk, total, prev_alloc);
+    allocSplit(a, total, newsize, blk);                     /*the last one, and split if necessary*/
+    *out = blk + 1;
+    return count;
+}
+
+/*grow the heap until it ends in a free block of at least size bytes and return that block, already
+coalesced with a free block at the old end of the heap and placed in its bin; NULL if the heap cannot grow*/
+word_t* extendHeap(arena_t* a, size_t size)
+{
+    drainIdle(a);
+    word_t* epilogue = (word_t *)(mem_region_hi(a->region) + 1) - 1;
+    if (prevAllocStatus(epilogue) == FREE)                  /*only ask for what the free block at the end lacks*/
+        size -= blockSize(prevBlock(epilogue));
+
+    word_t* new_mem = mem_region_sbrk(a->region, size); 
+    if (new_mem == (void*) - 1)
+        return NULL;
+    EVENT(extends, 1);
+    EVENT(extend_bytes, size);
+    PROBE2(extend, a->region, size);
+
+    /*the old epilogue becomes the header of the new block*/
+    new_mem = new_mem - 1;
+    initBlock(new_mem, size, prevAllocStatus(new_mem));
+    
+    /*new epilogue, right after a free block*/
+    *(nextBlock(new_mem)) = ALLOCATED;
+    
+    return (word_t*) (coalesce(a, new_mem));                   /*coalesce new free block with any adjacent free blocks*/
+}
+
+/*bytes to cut off the front of the block at blk for its payload to start skew bytes past a multiple of
+align, counted from the start of the heap: 0, or enough for the cut-off part to stand as a free block*/
+size_t alignLead(word_t* blk, size_t align, size_t skew)
+{
+    size_t offset = (char*)(blk + 1) - heap_base - skew;
+    size_t lead = (align - offset % align) % align;
+    while (lead != 0 && lead < MINBLOCKSIZE)
+        lead += align;
+    return lead;
+}
+
+/*a free block that holds newsize once its lead for align is cut off, NULL if none does. Blocks of the
+bins a padded request would skip are tried one by one, since where they start decides whether they fit;
+past those, the head of any list bin fits, and in the treap the best fit for newsize usually does,
+with the best fit for the padded size as fallback. The caller holds the arena lock*/
+word_t* alignedFit(arena_t* a, size_t newsize, size_t align, size_t skew)
+{
+    size_t padded = newsize + align + MINBLOCKSIZE;         /*fits whatever the lead*/
+    int bin = findBin(newsize);
+    a->searches++;
+    EVENT(searches, 1);
+    for (unsigned int bins = a->binmap & ~((1u << bin) - 1); bins != 0; bins &= bins - 1)
+    {
+        bin = __builtin_ctz(bins);
+        if (bin == TREE_BIN)
+            break;
+        if (bin > findBin(padded))
+            return getSucc(a->bins[bin]);
+        for (word_t* blk = getSucc(a->bins[bin]); !endOfList(blk); blk = getSucc(blk))
+        {
+            a->search_steps++;
+            EVENT(search_steps, 1);
+            if (blockSize(blk) >= alignLead(blk, align, skew) + newsize)
+                return blk;
+        }
+    }
+
+    word_t* blk = treeFit(a, newsize);
+    if (blk != NULL && blockSize(blk) < alignLead(blk, align, skew) + newsize)
+        blk = treeFit(a, padded);
+    return blk;
+}
+
+/*allocate a block of newsize whose payload starts skew bytes past a multiple of align, counted from
+the start of the heap. It is carved out of a free block that fits it after alignment, or out of new heap
+memory that extends the block at the end of the heap by just what is missing. The lead in front of the
+block goes back to the bins as a free block of its own and anything left behind it is split off and
+coalesced by allocSplit, so alignment costs no memory past the time the block is allocated. The caller
+holds the arena lock*/
+word_t* allocAligned(arena_t* a, size_t newsize, size_t align, size_t skew)
+{
+    word_t* blk = alignedFit(a, newsize, align, skew);
+    if (blk == NULL && reclaimSlack(a))
+        blk = alignedFit(a, newsize, align, skew);
+    if (blk == NULL)
+    {
+        /*the new memory starts at the free block ending the heap if there is one, else at the epilogue*/
+        word_t* epilogue = (word_t *)(mem_region_hi(a->region) + 1) - 1;
+        word_t* end = prevAllocStatus(epilogue) == FREE ? prevBlock(epilogue) : epilogue;
+        size_t needed = alignLead(end, align, skew) + newsize;
+        if (end != epilogue && blockSize(end) >= needed)
+            blk = end;                                      /*a treap block alignedFit passed over*/
+        else if ((blk = extendHeap(a, needed)) == NULL)
+            return NULL;
+    }
+    splice(a, blk);
+
+    size_t total = blockSize(blk);
+    size_t lead = alignLead(blk, align, skew);
+    if (lead != 0)
+    {
+        /*neighbours of a binned free block are allocated, so the lead needs no coalescing*/
+        initBlock(blk + lead / WSIZE, total - lead, FREE);
+        setBlockSize(blk, lead);
+        setAllocStatus(blk, FREE);
+        insertFreeBlock(a, findBin(lead), blk);
+        blk = blk + lead / WSIZE;
+        total -= lead;
+    }
+    setBlockSize(blk, total);
+    allocSplit(a, total, newsize, blk);                        /*allocate it and split off the tail if necessary*/
+    return blk;
+}
+
+/*a block of newsize in a chunk of whole pages mapped for it alone, its payload a multiple of align, at least
+ALIGNMENT. The block starts lead bytes into the chunk, past a word of padding, and its header's size covers
+the rest of the chunk; the padding word right before the header holds lead, so the chunk can be found
+again from the block*/
+word_t* mapBlock(size_t newsize, size_t align)
+{
+    size_t pagesize = mem_pagesize();
+    size_t max_lead = align - WSIZE - WSIZE;
+    size_t size = (WSIZE + max_lead + newsize + pagesize - 1) & ~(pagesize - 1);
+    if (size > MAP_MAX)
+        return NULL;
+    char* chunk = mem_map(size);
+    if (chunk == NULL)
+        return NULL;
+    EVENT(maps, 1);
+    PROBE1(map, size);
+
+    size_t lead = (size_t)(-(uintptr_t)(chunk + WSIZE + WSIZE)) & (align - 1);
+    word_t* blk = (word_t*)(chunk + lead + WSIZE);
+    *(blk - 1) = lead;
+    *blk = (size - lead) | ALLOCATED;
+    return blk;
+}
+
+/*the chunk a mapped block was mapped in*/
+void* mappedChunk(word_t* blk){return (char*)(blk - 1) - *(blk - 1);}
+
+/*realloc for the mapped block at ptr: its chunk is resized with mem_remap, which moves pages rather than
+bytes, unless size has dropped below mmap_threshold and the payload is copied into the heap instead*/
+void* remapBlock(void* ptr, size_t size)
+{
+    if (size > MAP_MAX)
+        return NULL;
+    size_t newsize = adjustSize(size);
+    word_t* blk = (word_t*)ptr - 1;
+    size_t lead = *(blk - 1);
+
+    if (newsize < mmap_threshold && newsize <= MAX_HEAP)
+    {
+        size_t old_payload = blockSize(blk) - WSIZE - WSIZE;
+        void* new_ptr = mm_malloc(size);
+        if (new_ptr != NULL)
+        {
+            memcpy(new_ptr, ptr, size < old_payload ? size : old_payload);
+            mem_unmap(mappedChunk(blk));
+        }
+        return new_ptr;
+    }
+
+    size_t pagesize = mem_pagesize();
+    size_t chunk_size = (WSIZE + lead + newsize + pagesize - 1) & ~(pagesize - 1);
+    if (chunk_size > MAP_MAX)
+        return NULL;
+    if (chunk_size == lead + blockSize(blk))
+        return ptr;
+    char* chunk = mem_remap(mappedChunk(blk), chunk_size);
+    if (chunk == NULL)
+        return NULL;
+
+    blk = (word_t*)(chunk + lead + WSIZE);
+    *blk = (chunk_size - lead) | ALLOCATED;
+    return blk + 1;
+}
+
+/*
+ * mm_set_mmap_threshold - Blocks of at least size bytes, header included, are mapped on their own from
+ *     now on. Blocks small enough for the thread caches never are, so lower thresholds are raised past them.
+ */
+void mm_set_mmap_threshold(size_t size)
+{
+    mmap_threshold = size > TCACHE_MAX ? size : TCACHE_MAX + ALIGNMENT;
+}
+
+/*
+ * mm_fork_prepare, mm_fork_parent, mm_fork_child - fork handlers for a process using the package as its
+ *     malloc: every arena lock, then memlib's, is held across fork, so the child starts with none of them
+ *     taken by a thread it does not have.
+ */
+void mm_fork_prepare(void)
+{
+    for (int r = 0; r < MEM_REGIONS; r++)
+        pthread_mutex_lock(&arenas[r].lock);
+    mem_fork_prepare();
+}
+
+void mm_fork_parent(void)
+{
+    mem_fork_parent();
+    for (int r = MEM_REGIONS - 1; r >= 0; r--)
+        pthread_mutex_unlock(&arenas[r].lock);
+}
+
+void mm_fork_child(void)
+{
+    mem_fork_child();
+    for (int r = 0; r < MEM_REGIONS; r++)
+        pthread_mutex_init(&arenas[r].lock, NULL);
+}
+
+/*thread exit hook: give every block still cached by the exiting thread back to the bins, and its events
+to those of exited threads*/
+static void releaseCache(void* arg)
+{
+    tcache_t* tc = arg;
+    if (tc->epoch != heap_epoch)
+        return;
+    for (int idx = 0; idx < TCACHE_BINS; idx++)
+        if (tc->count[idx] > 0)
+            flushCache(tc, idx, tc->count[idx]);
+#if MM_EVENTS
+    pthread_mutex_lock(&retired_lock);
+    addEvents(&retired_events, &tc->events);
+    pthread_mutex_unlock(&retired_lock);
+#endif
+}
+
+static void createCacheKey(void){pthread_key_create(&tcache_key, releaseCache);}
+
+/*the calling thread's cache, emptied first if it still holds blocks of a heap from before the last mm_init,
+in which case the thread is also bound to the arena of the CPU it runs on*/
+tcache_t* threadCache(void)
+{
+    tcache_t* tc = &tcache;
+    if (tc->epoch != heap_epoch)
+    {
+        int cpu = sched_getcpu();                   /*the arena stays the same even if the thread migrates*/
+        memset(tc, 0, sizeof(tcache_t));
+        tc->arena = &arenas[(cpu < 0 ? 0 : cpu) % arena_count];
+        tc->epoch = heap_epoch;
+        pthread_once(&tcache_once, createCacheKey);
+        pthread_setspecific(tcache_key, tc);
+    }
+    return tc;
+}
+
+/*on a cache miss, fill cache bin idx with a batch under a single lock and return the caller's entry.
+For a slab class the batch is TCACHE_BATCH objects. For blocks, the caller's block is allocated and up
+to TCACHE_BATCH - 1 spares of the same size are peeled off the top of the free block it came from;
+spares are only carved from surplus already in the bins, so a refill never grows the heap*/
+void* refillCache(tcache_t* tc, int idx, size_t newsize)
+{
+    void* ptr = NULL;
+    for (arena_t* a = lockArena(tc); a != NULL; a = nextArena(tc, a))
+    {
+        if ((ptr = refillFrom(tc, a, idx, newsize)) != NULL)
+        {
+            pthread_mutex_unlock(&a->lock);
+            break;
+        }
+    }
+    return ptr;
+}
+
+/*refillCache's work in a, which the caller has locked and unlocks; NULL if a's region is full*/
+void* refillFrom(tcache_t* tc, arena_t* a, int idx, size_t newsize)
+{
+    if (idx < SLAB_CLASSES)
+    {
+        void* obj = slabAlloc(a, idx);
+        for (int i = 1; obj != NULL && i < TCACHE_BATCH; i++)
+        {
+            void* spare = slabAlloc(a, idx);
+            if (spare == NULL)
+                break;
+            *(void**)spare = tc->head[idx];
+            tc->head[idx] = spare;
+            tc->count[idx]++;
+        }
+        return obj;
+    }
+
+    word_t* blk = findFit(a, newsize);
+    if (blk == NULL)
+    {
+        blk = allocFound(a, NULL, newsize);             /*the bins were just searched*/
+        return blk == NULL ? NULL : blk + 1;
+    }
+
+    splice(a, blk);
+    size_t total = blockSize(blk);
+    for (int i = 1; i < TCACHE_BATCH && tc->count[idx] < TCACHE_FILL && total >= newsize + newsize; i++)
+    {
+        total -= newsize;
+        word_t* spare = blk + total / WSIZE;
+        initBlock(spare, newsize, ALLOCATED);
+        setAllocStatus(spare, ALLOCATED);
+        *(void**)(spare + 1) = tc->head[idx];
+        tc->head[idx] = spare + 1;
+        tc->count[idx]++;
+    }
+    setBlockSize(blk, total);
+    allocSplit(a, total, newsize, blk);        /*allocate what is left to the caller and split if necessary*/
+    return blk + 1;
+}
+
+/*return the n most recently cached entries of cache bin idx to their arenas: the thread's own arena under
+a single lock, any other through freeForeign*/
+void flushCache(tcache_t* tc, int idx, int n)
+{
+    arena_t* a = tc->arena;
+    int locked = 0;
+    for (int i = 0; i < n; i++)
+    {
+        void* ptr = tc->head[idx];
+        tc->head[idx] = *(void**)ptr;
+        if (arenaOf(ptr) != a)
+        {
+            freeForeign(arenaOf(ptr), ptr);
+            continue;
+        }
+        if (!locked)
+        {
+            lockDrained(a);
+            locked = 1;
+        }
+        if (idx < SLAB_CLASSES)
+            slabFree(a, ptr);
+        else
+            releaseBlock(a, (word_t*)ptr - 1);         /*free and coalesce, giving pages back if that frees enough*/
+    }
+    tc->count[idx] -= n;
+    if (locked)
+        pthread_mutex_unlock(&a->lock);
+}
+
+/*the run holding ptr, or NULL if ptr is the payload of an ordinary block*/
+run_t* runOf(void* ptr)
+{
+    size_t page = ((char*)ptr - heap_base) / RUN_SIZE;
+    return runmap[page] ? (run_t*)(heap_base + page * RUN_SIZE) : NULL;
+}
+
+void linkRun(arena_t* a, run_t* run, int cls)
+{
+    run->prev = NULL;
+    run->next = a->partial_runs[cls];
+    if (run->next != NULL)
+        run->next->prev = run;
+    a->partial_runs[cls] = run;
+}
+
+void unlinkRun(arena_t* a, run_t* run, int cls)
+{
+    if (run->prev != NULL)
+        run->prev->next = run->next;
+    else
+        a->partial_runs[cls] = run->next;
+    if (run->next != NULL)
+        run->next->prev = run->prev;
+}
+
+/*hand out an object of class cls, carving a new run from the heap when no run of the class has room;
+the caller holds the arena lock*/
+void* slabAlloc(arena_t* a, int cls)
+{
+    run_t* run = a->partial_runs[cls];
+    if (run == NULL)
+    {
+        word_t* blk = allocAligned(a, RUN_SIZE, RUN_SIZE, 0);   /*payload right on the boundary*/
+        if (blk == NULL)
+            return NULL;
+        run = (run_t*)(blk + 1);
+        run->objsize = (cls + 1) * ALIGNMENT;
+        run->capacity = (RUN_SIZE - WSIZE - ALIGN(sizeof(run_t))) / run->objsize;  /*objects end before the next run's header*/
+        run->live = 0;
+        run->free_objs = NULL;
+        run->unused = (char*)run + ALIGN(sizeof(run_t));
+        runmap[((char*)run - heap_base) / RUN_SIZE] = 1;
+        linkRun(a, run, cls);
+    }
+
+    void* obj = run->free_objs;
+    if (obj != NULL)
+        run->free_objs = *(void**)obj;
+    else
+    {
+        obj = run->unused;
+        run->unused += run->objsize;
+    }
+    if (++run->live == run->capacity)           /*full runs leave the partial list*/
+        unlinkRun(a, run, cls);
+    return obj;
+}
+
+/*give obj back to its run. A run left empty goes back to the heap unless it is the last run of its
+class with room, which is kept to avoid carving a new run on the next request; the caller holds the arena lock*/
+void slabFree(arena_t* a, void* obj)
+{
+    run_t* run = runOf(obj);
+    int cls = slabClass(run->objsize);
+
+    *(void**)obj = run->free_objs;
+    run->free_objs = obj;
+    if (run->live-- == run->capacity)
+        linkRun(a, run, cls);
+
+    if (run->live == 0 && (a->partial_runs[cls] != run || run->next != NULL))
+    {
+        unlinkRun(a, run, cls);
+        runmap[((char*)run - heap_base) / RUN_SIZE] = 0;
+        releaseBlock(a, (word_t*)run - 1);
+    }
+}
+
+/*this function checks if a block can be splitted, set the headers and footers of the blocks,
+return the free block to its appropriate free list, and mark the allocated block*/
+void allocSplit(arena_t* a, size_t total, size_t taken, word_t* taken_blk)
+/*block @ taken_blk will be allocated with size taken and any leftover will be free block*/
+{
+    EVENT(split_tries, 1);
+    if (total > taken && total - taken >= MINBLOCKSIZE)
+    {
+        EVENT(splits, 1);
+        PROBE2(split, total, taken);
+        setBlockSize(taken_blk, taken);
+
+        /*set fields for the remaining memory*/
+        word_t* remains_blk = nextBlock(taken_blk);
+        initBlock(remains_blk, total - taken, ALLOCATED);
+        
+        /*coalesce remaining memory with any adjacent free block*/
+        setAllocStatus(taken_blk, ALLOCATED);
+        coalesce(a, remains_blk);
+    }
+    setAllocStatus(taken_blk, ALLOCATED);  /*mark taken_blk as ALLOCATED*/
+}
+
+void* coalesce(arena_t* a, word_t* to_free)
+{    
+    /*previous and next both allocated, simply reset allocate bit*/
+    if(allocStatus(nextBlock(to_free)) == ALLOCATED && prevAllocStatus(to_free) == ALLOCATED)
+    {
+        EVENT(coalesce[0], 1);
+        PROBE2(coalesce, 0, blockSize(to_free));
+        setAllocStatus(to_free, FREE);
+
+        /*add free block to head of free list*/
+        insertFreeBlock(a, findBin(blockSize(to_free)), to_free);
+        return (void*) to_free;
+    }
+
+    /*next block free, previous block allocated*/
+    else if (allocStatus(nextBlock(to_free)) == FREE && prevAllocStatus(to_free) == ALLOCATED)
+    {
+        EVENT(coalesce[1], 1);
+        PROBE2(coalesce, 1, blockSize(to_free));
+        /*splice free next block*/
+        word_t* next_block_head = nextBlock(to_free);
+        splice(a, next_block_head);
+
+        /*change to total size*/
+        setBlockSize(to_free, blockSize(to_free) + blockSize(next_block_head));
+        setAllocStatus(to_free, FREE);
+
+        /*add free block to head of free list*/
+        insertFreeBlock(a, findBin(blockSize(to_free)), to_free);
+        return (void*) to_free;
+    }
+
+    /*previous block free, next block allocated*/
+    else if (allocStatus(nextBlock(to_free)) == ALLOCATED && prevAllocStatus(to_free) == FREE)
+    {
+        EVENT(coalesce[2], 1);
+        PROBE2(coalesce, 2, blockSize(to_free));
+        /*splice free prev block*/
+        word_t* prev_block_head = prevBlock(to_free);
+        splice(a, prev_block_head);
+
+        /*change to total size*/
+        setBlockSize(prev_block_head, blockSize(prev_block_head) + blockSize(to_free));
+        setAllocStatus(prev_block_head, FREE);
+
+        /*add free block to head of free list*/
+        insertFreeBlock(a, findBin(blockSize(prev_block_head)), prev_block_head);
+        return (void*) prev_block_head;
+    }
+
+    /*previous and next free*/
+    else
+    {
+        EVENT(coalesce[3], 1);
+        PROBE2(coalesce, 3, blockSize(to_free));
+        /*splice free prev block*/
+        word_t* prev_block_head = prevBlock(to_free);
+        splice(a, prev_block_head);
+
+        /*splice free next block*/
+        word_t* next_block_head = nextBlock(to_free);
+        splice(a, next_block_head);
+
+        /*change to total size*/
+        setBlockSize(prev_block_head, blockSize(prev_block_head) + blockSize(to_free) + blockSize(next_block_head));
+        setAllocStatus(prev_block_head, FREE);
+
+        /*add free block to head of free list*/
+        insertFreeBlock(a, findBin(blockSize(prev_block_head)), prev_block_head);
+        return (void*) prev_block_head;
+    }
+}
+
+/*free and coalesce blk like coalesce, then, on a heap backed by mmap (MEM_USE_MMAP), give memory back
+to the system if that leaves a free block of at least RELEASE_THRESHOLD: a block ending the heap is
+trimmed down to TRIM_KEEP bytes, and for any other the pages blk lies on are discarded as far as they
+are free as a whole now, keeping the header, links and footer readable. A page is thus discarded by the
+free that empties it, even when every block on it is smaller than a page. The caller holds the arena lock*/
+void releaseBlock(arena_t* a, word_t* blk)
+{
+    size_t pagesize = mem_pagesize();
+    char* lo = (char*)((uintptr_t)blk & ~(pagesize - 1));
+    char* hi = (char*)(((uintptr_t)nextBlock(blk) + pagesize - 1) & ~(pagesize - 1));
+    word_t* merged = coalesce(a, blk);
+    size_t size = blockSize(merged);
+    if (!MEM_USE_MMAP || size < RELEASE_THRESHOLD)     /*a simulated heap has nothing to give back*/
+        return;
+
+    if (atEpilogue(nextBlock(merged)))
+    {
+        size_t trim = (size - TRIM_KEEP) & ~(pagesize - 1);
+        splice(a, merged);
+        setBlockSize(merged, size - trim);
+        *(nextBlock(merged)) = ALLOCATED;           /*new epilogue, right after a free block*/
+        setAllocStatus(merged, FREE);
+        insertFreeBlock(a, findBin(size - trim), merged);
+        mem_region_sbrk(a->region, -(int)trim);
+        return;
+    }
+
+    if (lo < (char*)merged + MINBLOCKSIZE)
+        lo = (char*)merged + MINBLOCKSIZE;
+    if (hi > (char*)nextBlock(merged) - WSIZE)
+        hi = (char*)nextBlock(merged) - WSIZE;
+    mem_discard(lo, hi - lo);
+}
+
+void insertFreeBlock(arena_t* a, int bin, word_t* block)
+{
+    a->bin_blocks[bin]++;
+    a->bin_bytes[bin] += blockSize(block);
+    if (bin == TREE_BIN)
+    {
+        treeInsert(&a->tree_root, block);
+        a->binmap |= 1u << TREE_BIN;
+        return;
+    }
+
+    word_t* free_list = a->bins[bin];
+    word_t* cur_first_block = getSucc(free_list);
+    setSucc(block, cur_first_block);
+    setPred(cur_first_block, block);
+    setSucc(free_list, block);
+    setPred(block, free_list);
+    a->binmap |= 1u << bin;
+}
+
+void splice(arena_t* a, word_t* block)
+{
+    int bin = findBin(blockSize(block));
+    a->bin_blocks[bin]--;
+    a->bin_bytes[bin] -= blockSize(block);
+    if (bin == TREE_BIN)
+    {
+        treeRemove(a, block);
+        if (a->tree_root == 0)
+            a->binmap &= ~(1u << TREE_BIN);
+        return;
+    }
+
+    word_t* pred = getPred(block);
+    word_t* succ = getSucc(block);
+    setSucc(pred, succ);
+    setPred(succ, pred);
+
+    /*pred is the sentinel head and succ the sentinel tail -> the bin is now empty*/
+    if (getPred(pred) == NULL && endOfList(succ))
+        a->binmap &= ~(1u << bin);
+}
+
+/*block size for a payload of size: a header plus the payload, at least large enough to be freed*/
+size_t adjustSize(size_t size)
+{
+    size_t newsize = ALIGN(size + WSIZE);
+    return newsize < MINBLOCKSIZE ? MINBLOCKSIZE : newsize;
+}
+
+/*bin b holds blocks of size (2^(b+3), 2^(b+4)], i.e. bin = ceil(log2(size)) - 4, with
+bin 0 taking everything up to 16 bytes and TREE_BIN everything above 8 KB*/
+int findBin(size_t size)
+{
+    if (size <= 16) return 0;
+    int bin = (int)(sizeof(size_t) * 8) - __builtin_clzl(size - 1) - 4;
+    return bin < TREE_BIN ? bin : TREE_BIN;
+}
+
+/*the treap is a binary search tree over (size, address) whose nodes are the large free blocks
+themselves, with left and right child offsets in the words used for pred and succ in list bins.
+Priorities are a hash of the block's offset, so the tree is balanced in expectation without
+storing anything more*/
+word_t* getLeft(word_t* node){return fromOffset(*(node + 1));}
+word_t* getRight(word_t* node){return fromOffset(*(node + 2));}
+word_t treePriority(word_t* node){return toOffset(node) * 2654435761u;}
+int treeBefore(word_t* a, word_t* b)
+{
+    return blockSize(a) < blockSize(b) || (blockSize(a) == blockSize(b) && a < b);
+}
+
+/*lift the left (rotateRight) or right (rotateLeft) child of the subtree at *link to its root*/
+void rotateRight(word_t* link)
+{
+    word_t* root = fromOffset(*link);
+    word_t* pivot = getLeft(root);
+    *(root + 1) = *(pivot + 2);
+    *(pivot + 2) = toOffset(root);
+    *link = toOffset(pivot);
+}
+
+void rotateLeft(word_t* link)
+{
+    word_t* root = fromOffset(*link);
+    word_t* pivot = getRight(root);
+    *(root + 2) = *(pivot + 1);
+    *(pivot + 1) = toOffset(root);
+    *link = toOffset(pivot);
+}
+
+/*insert node into the subtree at *link as a leaf, then rotate it up past lower priorities*/
+void treeInsert(word_t* link, word_t* node)
+{
+    word_t* root = fromOffset(*link);
+    if (root == NULL)
+    {
+        *(node + 1) = 0;
+        *(node + 2) = 0;
+        *link = toOffset(node);
+    }
+    else if (treeBefore(node, root))
+    {
+        treeInsert(root + 1, node);
+        if (treePriority(getLeft(root)) > treePriority(root))
+            rotateRight(link);
+    }
+    else
+    {
+        treeInsert(root + 2, node);
+        if (treePriority(getRight(root)) > treePriority(root))
+            rotateLeft(link);
+    }
+}
+
+/*find node, rotate it down below its higher priority child until it has at most one child, then unlink it*/
+void treeRemove(arena_t* a, word_t* node)
+{
+    word_t* link = &a->tree_root;
+    while (fromOffset(*link) != node)
+        link = treeBefore(node, fromOffset(*link)) ? fromOffset(*link) + 1 : fromOffset(*link) + 2;
+
+    while (getLeft(node) != NULL && getRight(node) != NULL)
+    {
+        if (treePriority(getLeft(node)) > treePriority(getRight(node)))
+        {
+            rotateRight(link);
+            link = fromOffset(*link) + 2;
+        }
+        else
+        {
+            rotateLeft(link);
+            link = fromOffset(*link) + 1;
+        }
+    }
+    *link = getLeft(node) != NULL ? *(node + 1) : *(node + 2);
+}
+
+/*size of the largest free block of an arena: the rightmost node of the treap, else the largest block of the
+highest non-empty list bin; the caller holds the arena lock*/
+size_t largestFree(arena_t* a)
+{
+    if (a->binmap == 0)
+        return 0;
+    if (a->tree_root != 0)
+    {
+        word_t* node = fromOffset(a->tree_root);
+        while (getRight(node) != NULL)
+            node = getRight(node);
+        return blockSize(node);
+    }
+    size_t largest = 0;
+    word_t* free_list = a->bins[31 - __builtin_clz(a->binmap)];
+    for (word_t* blk = getSucc(free_list); !endOfList(blk); blk = getSucc(blk))
+        if (blockSize(blk) > largest)
+            largest = blockSize(blk);
+    return largest;
+}
+
+/*best fit: the smallest block of at least newsize, lowest address first among equal sizes*/
+word_t* treeFit(arena_t* a, size_t newsize)
+{
+    word_t* best = NULL;
+    word_t* node = fromOffset(a->tree_root);
+    while (node != NULL)
+    {
+        a->search_steps++;
+        EVENT(search_steps, 1);
+        if (blockSize(node) >= newsize)
+        {
+            best = node;
+            node = getLeft(node);
+        }
+        else
+            node = getRight(node);
+    }
+    return best;
+}
+
+/*report a problem with the block at blk for mm_check, counting it once*/
+int checkReport(arena_t* a, word_t* blk, const char* problem)
+{
+    fprintf(stderr, "mm_check: arena %d, block at offset %u: %s\n", a->region, toOffset(blk), problem);
+    return 1;
+}
+
+/*the epilogue of arena a, and whether blk lies in a's heap before it, so it can be read*/
+word_t* arenaEnd(arena_t* a){return (word_t *)(mem_region_hi(a->region) + 1) - 1;}
+int inArena(arena_t* a, word_t* blk)
+{
+    return blk != NULL && (char*)blk >= heap_base + (size_t)a->region * MAX_HEAP && blk < arenaEnd(a);
+}
+
+/*check a free block's place in its bin from the block itself: its list neighbours link back to it and
+are free blocks of the same bin or the bin's sentinels, or it is found in the treap by its key and its
+children are ordered around it*/
+int checkBinned(arena_t* a, word_t* blk)
+{
+    int bin = findBin(blockSize(blk));
+    if (bin == TREE_BIN)
+    {
+        word_t* node = fromOffset(a->tree_root);
+        for (int depth = 0; node != NULL && node != blk && depth < 64; depth++)
+            node = treeBefore(blk, node) ? getLeft(node) : getRight(node);
+        if (node != blk)
+            return checkReport(a, blk, "free block missing from the treap");
+        word_t* left = getLeft(blk);
+        word_t* right = getRight(blk);
+        if ((left != NULL && (!inArena(a, left) || !treeBefore(left, blk) || treePriority(left) > treePriority(blk))) ||
+            (right != NULL && (!inArena(a, right) || !treeBefore(blk, right) || treePriority(right) > treePriority(blk))))
+            return checkReport(a, blk, "treap children out of order");
+        return 0;
+    }
+
+    word_t* head = a->bins[bin];
+    word_t* tail = nextBlock(head);
+    word_t* pred = getPred(blk);
+    word_t* succ = getSucc(blk);
+    if ((pred != head && !inArena(a, pred)) || (succ != tail && !inArena(a, succ)))
+        return checkReport(a, blk, "free list link points outside the heap");
+    if (getSucc(pred) != blk || getPred(succ) != blk)
+        return checkReport(a, blk, "free list links are not symmetric");
+    if ((pred != head && (allocStatus(pred) == ALLOCATED || findBin(blockSize(pred)) != bin)) ||
+        (succ != tail && (allocStatus(succ) == ALLOCATED || findBin(blockSize(succ)) != bin)))
+        return checkReport(a, blk, "free block linked into the wrong bin");
+    return 0;
+}
+
+/*check what can be checked of blk and its neighbours without walking the heap*/
+int checkBlock(arena_t* a, word_t* blk)
+{
+    size_t size = blockSize(blk);
+    if (size < MINBLOCKSIZE || size % ALIGNMENT != 0 || blk + size / WSIZE > arenaEnd(a))
+        return checkReport(a, blk, "bad block size");
+    if ((uintptr_t)(blk + 1) % ALIGNMENT != 0)
+        return checkReport(a, blk, "misaligned payload");
+
+    word_t* next = nextBlock(blk);
+    int errors = 0;
+    if (prevAllocStatus(next) != allocStatus(blk))
+        errors += checkReport(a, blk, "prev-alloc bit of the next block disagrees");
+    if (allocStatus(blk) == ALLOCATED)
+        return errors;
+    if (*(next - 1) != size)
+        errors += checkReport(a, blk, "footer disagrees with header");
+    if (prevAllocStatus(blk) == FREE || allocStatus(next) == FREE)
+        errors += checkReport(a, blk, "free block next to another free block");
+    return errors + checkBinned(a, blk);
+}
+
+/*check the blocks logged since the last check that are still blocks of the heap*/
+int checkTouched(arena_t* a)
+{
+    int errors = 0;
+#if MM_CHECK
+    for (int i = 0; i < a->touched_count; i++)
+    {
+        word_t* blk = fromOffset(a->touched[i]);
+        if (blk != NULL && blk < arenaEnd(a))       /*blocks past the end were trimmed off*/
+            errors += checkBlock(a, blk);
+    }
+#endif
+    return errors;
+}
+
+/*count the nodes of the treap below node, checking that each is a free block of TREE_BIN*/
+size_t checkTree(arena_t* a, word_t* node, int depth, int* errors)
+{
+    if (node == NULL)
+        return 0;
+    if (!inArena(a, node) || depth > 64)
+    {
+        *errors += checkReport(a, node, "treap is broken");
+        return 0;
+    }
+    if (allocStatus(node) == ALLOCATED || findBin(blockSize(node)) != TREE_BIN)
+        *errors += checkReport(a, node, "treap holds a block it should not");
+    return 1 + checkTree(a, getLeft(node), depth + 1, errors) + checkTree(a, getRight(node), depth + 1, errors);
+}
+
+/*check every block of arena a, then every bin against the free blocks found*/
+int checkArena(arena_t* a)
+{
+    char* base = heap_base + (size_t)a->region * MAX_HEAP;
+    word_t* end = arenaEnd(a);
+    word_t* blk = (word_t*)(base + ARENA_OVERHEAD - WSIZE);   /*the first block after the bin sentinels*/
+    size_t free_blocks = 0;
+    size_t runs = 0;
+    int errors = 0;
+
+    for (; blk < end; blk = nextBlock(blk))
+    {
+        int found = checkBlock(a, blk);
+        errors += found;
+        if (found != 0 && (blockSize(blk) < MINBLOCKSIZE || nextBlock(blk) > end))
+            return errors;                                  /*cannot find the next block*/
+        if (allocStatus(blk) == FREE)
+            free_blocks++;
+        else if (blockSize(blk) == RUN_SIZE && runOf(blk + 1) == (run_t*)(blk + 1))
+            runs++;
+    }
+    if (blk != end || !atEpilogue(end))
+        errors += checkReport(a, end, "bad epilogue");
+
+    size_t binned = 0;
+    for (int bin = 0; bin < BINCOUNT; bin++)
+    {
+        word_t* tail = nextBlock(a->bins[bin]);
+        size_t count = 0;
+        for (word_t* cur = getSucc(a->bins[bin]); cur != tail; cur = getSucc(cur))
+        {
+            if (!inArena(a, cur) || count > free_blocks)
+            {
+                errors += checkReport(a, a->bins[bin], "free list is broken or cyclic");
+                break;
+            }
+            if (allocStatus(cur) == ALLOCATED || findBin(blockSize(cur)) != bin)
+                errors += checkReport(a, cur, "free list holds a block it should not");
+            count++;
+        }
+        if (count != a->bin_blocks[bin] || (count != 0) != ((a->binmap >> bin) & 1))
+            errors += checkReport(a, a->bins[bin], "bin counters or binmap disagree with the list");
+        binned += count;
+    }
+    size_t nodes = checkTree(a, fromOffset(a->tree_root), 0, &errors);
+    if (nodes != a->bin_blocks[TREE_BIN] || (nodes != 0) != ((a->binmap >> TREE_BIN) & 1))
+        errors += checkReport(a, end, "treap counters or binmap disagree with the treap");
+    if (binned + nodes != free_blocks)
+        errors += checkReport(a, end, "bins do not hold exactly the free blocks of the heap");
+
+    size_t mapped_runs = 0;
+    for (size_t page = (base - heap_base) / RUN_SIZE; heap_base + page * RUN_SIZE < (char*)end; page++)
+        mapped_runs += runmap[page];
+    if (mapped_runs != runs)
+        errors += checkReport(a, end, "runmap disagrees with the slab runs in the heap");
+    return errors;
+}
+
+void print_free_list(word_t* free_list_h)
+{
+    word_t* ptr = free_list_h;
+    while (!endOfList(ptr))
+    {
+        printf("%p -> ", (void*)ptr);
+        ptr = getSucc(ptr);
+    }
+    printf("EOL\n");
+}
+
+/*MALLOC-SPLIT FOR ADDRESS-ORDERED FREE LIST*/
+/*size_t* prev_free = getPred(taken_blk);
+size_t* next_free = getSucc(taken_blk);
+setSucc(prev_free, remains_blk);            
+setPred(remains_blk, prev_free);
+if(!atEpilogue(next_free))
+    setPred(next_free, remains_blk);
+setSucc(remains_blk, next_free);*/
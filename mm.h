@@ -4,6 +4,59 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_realloc_hint(void *ptr, size_t size, size_t expected);
+extern void mm_set_mmap_threshold(size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+extern void mm_fork_prepare(void);
+extern void mm_fork_parent(void);
+extern void mm_fork_child(void);
+
+/*
+ * Heap statistics filled in by mm_stats. Sizes are in bytes and include block headers.
+ */
+#define MM_STAT_BINS 11     /* 10 list bins for blocks up to 8 KB, then one for all larger ones */
+
+typedef struct {
+    size_t bin_blocks[MM_STAT_BINS];  /* free blocks in each bin */
+    size_t bin_bytes[MM_STAT_BINS];   /* bytes in those free blocks */
+    size_t free_blocks;     /* free blocks in all bins */
+    size_t free_bytes;      /* bytes in those free blocks */
+    size_t largest_free;    /* largest free block */
+    size_t live_bytes;      /* bytes of heap blocks in use, thread-cached ones included */
+    size_t mapped_bytes;    /* bytes of chunks mapped for single blocks */
+    size_t heap_size;       /* bytes taken from memlib, mapped chunks included */
+    double fragmentation;   /* external fragmentation: 1 - largest_free / free_bytes */
+    size_t searches;        /* fit searches through the bins since mm_init */
+    size_t search_steps;    /* free blocks those searches examined */
+} mm_stats_t;
+
+extern void mm_stats(mm_stats_t *stats);
+
+/*
+ * Hot-path event counts filled in by mm_events when mm.c is built with
+ * MM_EVENTS set. Every field is an unsigned long.
+ */
+typedef struct {
+    unsigned long mallocs;        /* calls to mm_malloc */
+    unsigned long frees;          /* calls to mm_free */
+    unsigned long reallocs;       /* calls to mm_realloc */
+    unsigned long cache_hits;     /* mm_malloc served by the thread cache */
+    unsigned long cache_misses;   /* mm_malloc refilling the thread cache */
+    unsigned long searches;       /* fit searches through the bins */
+    unsigned long search_steps;   /* free blocks those searches walked */
+    unsigned long extends;        /* times the heap grew (mem_region_sbrk) */
+    unsigned long extend_bytes;   /* bytes it grew by */
+    unsigned long coalesce[4];    /* freed blocks by neighbours: none, next, previous, both free */
+    unsigned long split_tries;    /* blocks allocSplit allocated */
+    unsigned long splits;         /* those it split a free remainder off */
+    unsigned long maps;           /* blocks mapped on their own */
+} mm_events_t;
+
+extern int mm_events(mm_events_t *events);
+extern int mm_check(int incremental);
 
 
 /* 
@@ -0,0 +1,713 @@
+/*
+ * mmrecord.c - Record the allocations of a real program as an mdriver trace
+ *
+ * Build libmmrecord.so with "make libmmrecord.so" and run a program as
+ *
+ *     unix> MMRECORD_OUT=prog.rep LD_PRELOAD=./libmmrecord.so prog ...
+ *
+ * Every call to malloc, calloc, realloc, free, posix_memalign,
+ * aligned_alloc and memalign is passed on to the real allocator and
+ * also logged. When the program exits, the log is turned into a trace
+ * at MMRECORD_OUT (default mmrecord.rep). The trace is in the binary
+ * format of bintrace.h if that name ends in ".bin", and in the .rep
+ * text format otherwise.
+ *
+ * Each block gets a new id when it is allocated. A hash table, split
+ * into independently locked stripes, maps the block's address to that
+ * id until the block is freed. Every request also takes a number from
+ * one global sequence counter, while it holds the stripe lock of its
+ * address, so all requests on the same block are numbered in the order
+ * they happened.
+ *
+ * Threads append their requests to a buffer of their own. A full
+ * buffer goes to MMRECORD_OUT.raw as one fixed-size chunk, sorted by
+ * sequence number. At exit the chunks are merged back into one
+ * sequence, and the ids are renumbered from 0 in order of first use.
+ * Requests on blocks the recorder never saw allocated are dropped.
+ * The raw log is removed once the trace has been written.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bintrace.h"
+
+#define BUF_RECS    4096    /* requests per thread buffer and raw chunk */
+#define STRIPES     256     /* independently locked parts of the table */
+#define STRIPE_MIN  1024    /* initial slots per stripe */
+#define BOOT_BYTES  8192    /* static heap used while finding libc's */
+
+#define SEQ_MASK    ((1ULL << 62) - 1)  /* low bits of seq: the number */
+#define SEQ_TYPE(s) ((int)((s) >> 62))  /* high bits of seq: the type */
+#define SEQ_PAD     (~0ULL)             /* pads a chunk past its end */
+#define NO_ID       0xffffffffU
+
+/* One request, as logged */
+typedef struct {
+    uint64_t seq;       /* type << 62 | sequence number */
+    uint32_t id;        /* id of the block */
+    uint32_t size;      /* bytes requested (alloc and realloc) */
+} rec_t;
+
+/* A thread's buffer of requests not yet written to the raw log */
+typedef struct buf_t {
+    volatile int busy;  /* set while the owner is appending */
+    int n;              /* requests in recs */
+    struct buf_t *next; /* all buffers, for the flush at exit */
+    struct buf_t *free; /* buffers of exited threads, for reuse */
+    rec_t recs[BUF_RECS];
+} buf_t;
+
+/* One stripe of the address to id table (linear probing) */
+typedef struct {
+    pthread_mutex_t lock;
+    uintptr_t *keys;    /* block addresses, 0 for an empty slot */
+    uint32_t *ids;      /* ... and their ids */
+    size_t cap;         /* slots, a power of two */
+    size_t used;        /* occupied slots */
+} stripe_t;
+
+/* The allocator being recorded */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+
+static volatile int recording;          /* log requests while set */
+static volatile int resolving;          /* finding libc's functions */
+static char boot_heap[BOOT_BYTES];      /* serves dlsym's own allocations */
+static size_t boot_used;
+
+static uint64_t next_seq;               /* global request counter */
+static uint32_t next_id;                /* global block id counter */
+static stripe_t stripes[STRIPES];
+
+static char out_path[4096];             /* the trace to write at exit */
+static char raw_path[4096 + 8];         /* the raw log of chunks */
+static int raw_fd = -1;
+static pthread_mutex_t raw_lock = PTHREAD_MUTEX_INITIALIZER;
+static buf_t *all_bufs;                 /* guarded by raw_lock */
+static buf_t *free_bufs;                /* guarded by raw_lock */
+static pthread_key_t buf_key;
+
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+static TLS buf_t *my_buf;
+static TLS int in_recorder;             /* stops recursion through libc */
+
+/*************************************
+ * The address to id table
+ ************************************/
+
+static size_t hash_addr(uintptr_t addr)
+{
+    return (size_t)((addr >> 4) * 0x9E3779B97F4A7C15ULL >> 32);
+}
+
+/* the stripe comes from the top bits of the hash, the slot from the low */
+static stripe_t *stripe_of(void *ptr)
+{
+    return &stripes[(hash_addr((uintptr_t)ptr) >> 24) % STRIPES];
+}
+
+/*
+ * table_alloc - Map zeroed key and id arrays of cap slots for s
+ */
+static int table_alloc(stripe_t *s, size_t cap)
+{
+    void *mem = mmap(NULL, cap * (sizeof(uintptr_t) + sizeof(uint32_t)),
+		     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mem == MAP_FAILED)
+	return 0;
+    s->keys = mem;
+    s->ids = (uint32_t *)(s->keys + cap);
+    s->cap = cap;
+    s->used = 0;
+    return 1;
+}
+
+static void table_put(stripe_t *s, uintptr_t key, uint32_t id);
+
+/*
+ * table_grow - Double the slots of s once it is half full
+ */
+static void table_grow(stripe_t *s)
+{
+    stripe_t old = *s;
+    size_t i;
+
+    if (!table_alloc(s, old.cap * 2)) {
+	*s = old;
+	return;
+    }
+    for (i = 0; i < old.cap; i++)
+	if (old.keys[i] != 0)
+	    table_put(s, old.keys[i], old.ids[i]);
+    munmap(old.keys, old.cap * (sizeof(uintptr_t) + sizeof(uint32_t)));
+}
+
+/*
+ * table_put - Map key to id in s; the caller holds its lock
+ */
+static void table_put(stripe_t *s, uintptr_t key, uint32_t id)
+{
+    size_t i;
+
+    if (s->keys == NULL && !table_alloc(s, STRIPE_MIN))
+	return;
+    if (2 * (s->used + 1) > s->cap)
+	table_grow(s);
+    for (i = hash_addr(key) & (s->cap - 1); s->keys[i] != 0;
+	 i = (i + 1) & (s->cap - 1))
+	if (s->keys[i] == key)
+	    break;
+    if (s->keys[i] == 0)
+	s->used++;
+    s->keys[i] = key;
+    s->ids[i] = id;
+}
+
+/*
+ * table_take - Remove key from s and return its id, or NO_ID if it is
+ *     not there. Later keys of the probe run are shifted back into the
+ *     hole so that no tombstones are needed.
+ */
+static uint32_t table_take(stripe_t *s, uintptr_t key)
+{
+    size_t i, j, home, mask = s->cap - 1;
+    uint32_t id;
+
+    if (s->keys == NULL)
+	return NO_ID;
+    for (i = hash_addr(key) & mask; s->keys[i] != key; i = (i + 1) & mask)
+	if (s->keys[i] == 0)
+	    return NO_ID;
+    id = s->ids[i];
+
+    for (j = (i + 1) & mask; s->keys[j] != 0; j = (j + 1) & mask) {
+	home = hash_addr(s->keys[j]) & mask;
+	/* move j into the hole at i unless its home lies in (i, j] */
+	if (((j - home) & mask) >= ((j - i) & mask)) {
+	    s->keys[i] = s->keys[j];
+	    s->ids[i] = s->ids[j];
+	    i = j;
+	}
+    }
+    s->keys[i] = 0;
+    s->used--;
+    return id;
+}
+
+/*************************************
+ * Per-thread buffers and the raw log
+ ************************************/
+
+/*
+ * flush_buf - Write b to the raw log as one chunk, padded to BUF_RECS
+ */
+static void flush_buf(buf_t *b)
+{
+    char *p = (char *)b->recs;
+    size_t left = sizeof(b->recs);
+    ssize_t n;
+
+    if (b->n == 0)
+	return;
+    memset(&b->recs[b->n], 0xff, (BUF_RECS - b->n) * sizeof(rec_t));
+    pthread_mutex_lock(&raw_lock);
+    while (left > 0 && (n = write(raw_fd, p, left)) != 0) {
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0)
+	    break;
+	p += n;
+	left -= n;
+    }
+    pthread_mutex_unlock(&raw_lock);
+    b->n = 0;
+}
+
+/*
+ * release_buf - At thread exit, flush the thread's buffer and keep it
+ *     for the next thread
+ */
+static void release_buf(void *ptr)
+{
+    buf_t *b = ptr;
+
+    flush_buf(b);
+    pthread_mutex_lock(&raw_lock);
+    b->free = free_bufs;
+    free_bufs = b;
+    pthread_mutex_unlock(&raw_lock);
+    my_buf = NULL;
+}
+
+/*
+ * get_buf - The calling thread's buffer, made on first use
+ */
+static buf_t *get_buf(void)
+{
+    buf_t *b;
+
+    if (my_buf != NULL)
+	return my_buf;
+
+    pthread_mutex_lock(&raw_lock);
+    if ((b = free_bufs) != NULL)
+	free_bufs = b->free;
+    pthread_mutex_unlock(&raw_lock);
+
+    if (b == NULL) {
+	b = mmap(NULL, sizeof(buf_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b == MAP_FAILED)
+	    return NULL;
+	pthread_mutex_lock(&raw_lock);
+	b->next = all_bufs;
+	all_bufs = b;
+	pthread_mutex_unlock(&raw_lock);
+    }
+    pthread_setspecific(buf_key, b);
+    return my_buf = b;
+}
+
+/*
+ * log_req - Append one request to the thread's buffer. The caller holds
+ *     the stripe lock of the block, which orders seq among the requests
+ *     on it.
+ */
+static void log_req(int type, uint32_t id, size_t size)
+{
+    buf_t *b = get_buf();
+    rec_t *r;
+
+    if (b == NULL)
+	return;
+    __atomic_store_n(&b->busy, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&recording, __ATOMIC_SEQ_CST)) {
+	r = &b->recs[b->n++];
+	r->seq = ((uint64_t)type << 62) |
+	    __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+	r->id = id;
+	r->size = size > 0xffffffffUL ? 0xffffffffU : (uint32_t)size;
+	if (b->n == BUF_RECS)
+	    flush_buf(b);
+    }
+    __atomic_store_n(&b->busy, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * record_alloc - Log a new block at ptr of size bytes
+ */
+static void record_alloc(void *ptr, size_t size)
+{
+    stripe_t *s;
+    uint32_t id;
+
+    if (ptr == NULL || !recording || in_recorder)
+	return;
+    in_recorder = 1;
+    s = stripe_of(ptr);
+    pthread_mutex_lock(&s->lock);
+    id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    table_put(s, (uintptr_t)ptr, id);
+    log_req(BT_ALLOC, id, size);
+    pthread_mutex_unlock(&s->lock);
+    in_recorder = 0;
+}
+
+/*
+ * record_release - Log that the block at ptr is freed (type BT_FREE)
+ *     or is being reallocated to size bytes (BT_REALLOC). Returns its
+ *     id, or NO_ID if the recorder never saw it allocated.
+ */
+static uint32_t record_release(void *ptr, int type, size_t size)
+{
+    stripe_t *s;
+    uint32_t id;
+
+    if (ptr == NULL || !recording || in_recorder)
+	return NO_ID;
+    in_recorder = 1;
+    s = stripe_of(ptr);
+    pthread_mutex_lock(&s->lock);
+    if ((id = table_take(s, (uintptr_t)ptr)) != NO_ID)
+	log_req(type, id, size);
+    pthread_mutex_unlock(&s->lock);
+    in_recorder = 0;
+    return id;
+}
+
+/*
+ * record_moved - The block with this id now lives at ptr
+ */
+static void record_moved(void *ptr, uint32_t id)
+{
+    stripe_t *s = stripe_of(ptr);
+
+    pthread_mutex_lock(&s->lock);
+    table_put(s, (uintptr_t)ptr, id);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*************************************
+ * Writing the trace at exit
+ ************************************/
+
+/* A position in one chunk of the raw log, for the merge */
+typedef struct {
+    rec_t *cur;
+    rec_t *end;
+} cursor_t;
+
+/*
+ * sift_down - Restore the min-heap order on seq below heap[i]
+ */
+static void sift_down(cursor_t *heap, size_t n, size_t i)
+{
+    cursor_t tmp;
+    size_t c;
+
+    while ((c = 2 * i + 1) < n) {
+	if (c + 1 < n && (heap[c + 1].cur->seq & SEQ_MASK) <
+	    (heap[c].cur->seq & SEQ_MASK))
+	    c++;
+	if ((heap[i].cur->seq & SEQ_MASK) <= (heap[c].cur->seq & SEQ_MASK))
+	    break;
+	tmp = heap[i];
+	heap[i] = heap[c];
+	heap[c] = tmp;
+	i = c;
+    }
+}
+
+/*
+ * merge_pass - Replay the raw log in sequence order, renumbering ids
+ *     by first use and dropping requests on ids never allocated. With
+ *     out == NULL it only counts into *num_ids, *num_ops and *peak
+ *     (the most bytes live at once); otherwise it writes the requests.
+ */
+static void merge_pass(rec_t *log, size_t nchunks, uint32_t *renum,
+		       uint32_t *live, FILE *out, int binary,
+		       uint32_t *num_ids, uint32_t *num_ops, uint64_t *peak)
+{
+    cursor_t *heap;
+    size_t n = 0, c;
+    uint64_t bytes = 0;
+    uint32_t id, ids = 0, ops = 0;
+    rec_t *r;
+    int type;
+
+    heap = mmap(NULL, (nchunks + 1) * sizeof(cursor_t),
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (heap == MAP_FAILED)
+	return;
+    for (c = 0; c < nchunks; c++)
+	if (log[c * BUF_RECS].seq != SEQ_PAD) {
+	    heap[n].cur = &log[c * BUF_RECS];
+	    heap[n].end = &log[(c + 1) * BUF_RECS];
+	    n++;
+	}
+    for (c = n; c-- > 0; )
+	sift_down(heap, n, c);
+    memset(renum, 0xff, (size_t)next_id * sizeof(uint32_t));
+
+    while (n > 0) {
+	r = heap[0].cur;
+	if (++heap[0].cur == heap[0].end || heap[0].cur->seq == SEQ_PAD)
+	    heap[0] = heap[--n];
+	sift_down(heap, n, 0);
+
+	type = SEQ_TYPE(r->seq);
+	if (r->id >= next_id)
+	    continue;
+	if (type == BT_ALLOC) {
+	    renum[r->id] = id = ids++;
+	}
+	else if ((id = renum[r->id]) == NO_ID)
+	    continue;
+
+	if (out == NULL) {
+	    bytes -= live[id];
+	    live[id] = (type == BT_FREE) ? 0 : r->size;
+	    bytes += live[id];
+	    if (bytes > *peak)
+		*peak = bytes;
+	}
+	else if (binary)
+	    bt_put_op(out, type, id, r->size);
+	else if (type == BT_FREE)
+	    fprintf(out, "f %u\n", id);
+	else
+	    fprintf(out, "%c %u %u\n", type == BT_ALLOC ? 'a' : 'r',
+		    id, r->size);
+	ops++;
+    }
+    munmap(heap, (nchunks + 1) * sizeof(cursor_t));
+    *num_ids = ids;
+    *num_ops = ops;
+}
+
+/*
+ * write_trace - Turn the raw log into the trace at out_path
+ */
+static void write_trace(void)
+{
+    struct stat st;
+    rec_t *log;
+    uint32_t *renum, *live;
+    uint32_t num_ids = 0, num_ops = 0;
+    uint64_t peak = 0;
+    size_t nchunks, len;
+    int binary;
+    FILE *out;
+
+    if (fstat(raw_fd, &st) < 0 || st.st_size == 0)
+	return;
+    nchunks = st.st_size / sizeof(((buf_t *)0)->recs);
+    log = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, raw_fd, 0);
+    if (log == MAP_FAILED)
+	return;
+    renum = mmap(NULL, 2 * ((size_t)next_id + 1) * sizeof(uint32_t),
+		 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (renum == MAP_FAILED) {
+	munmap(log, st.st_size);
+	return;
+    }
+    live = renum + next_id + 1;
+
+    len = strlen(out_path);
+    binary = len > 4 && strcmp(out_path + len - 4, ".bin") == 0;
+    if ((out = fopen(out_path, "w")) == NULL) {
+	perror(out_path);
+    }
+    else {
+	merge_pass(log, nchunks, renum, live, NULL, binary,
+		   &num_ids, &num_ops, &peak);
+	if (binary)
+	    bt_put_header(out, peak > 0x7fffffff ? 0x7fffffff : (int)peak,
+			  num_ids, num_ops, 1);
+	else
+	    fprintf(out, "%llu\n%u\n%u\n1\n", (unsigned long long)peak,
+		    num_ids, num_ops);
+	merge_pass(log, nchunks, renum, live, out, binary,
+		   &num_ids, &num_ops, &peak);
+	if (fclose(out) != 0)
+	    perror(out_path);
+    }
+    munmap(renum, 2 * ((size_t)next_id + 1) * sizeof(uint32_t));
+    munmap(log, st.st_size);
+}
+
+/*************************************
+ * Setup and teardown
+ ************************************/
+
+/*
+ * stop_in_child - A forked child runs unrecorded, and must not touch
+ *     the parent's log
+ */
+static void stop_in_child(void)
+{
+    recording = 0;
+    raw_fd = -1;
+}
+
+static void __attribute__((constructor)) recorder_init(void)
+{
+    char *env = getenv("MMRECORD_OUT");
+    int i;
+
+    if (real_malloc == NULL) {
+	resolving = 1;
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+	real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+	real_memalign = dlsym(RTLD_NEXT, "memalign");
+	resolving = 0;
+    }
+    if (raw_fd >= 0)
+	return;
+
+    snprintf(out_path, sizeof(out_path), "%s", env ? env : "mmrecord.rep");
+    snprintf(raw_path, sizeof(raw_path), "%s.raw", out_path);
+    for (i = 0; i < STRIPES; i++)
+	pthread_mutex_init(&stripes[i].lock, NULL);
+    if ((raw_fd = open(raw_path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+	perror(raw_path);
+	return;
+    }
+    pthread_key_create(&buf_key, release_buf);
+    pthread_atfork(NULL, NULL, stop_in_child);
+    recording = 1;
+}
+
+static void __attribute__((destructor)) recorder_fini(void)
+{
+    buf_t *b;
+
+    if (!recording)
+	return;
+
+    /* Stop logging, wait out requests being appended, flush them all */
+    __atomic_store_n(&recording, 0, __ATOMIC_SEQ_CST);
+    for (b = all_bufs; b != NULL; b = b->next) {
+	while (__atomic_load_n(&b->busy, __ATOMIC_SEQ_CST))
+	    ;
+	flush_buf(b);
+    }
+
+    write_trace();
+    close(raw_fd);
+    unlink(raw_path);
+}
+
+/*
+ * boot_alloc - Allocate from a static heap while dlsym looks for the
+ *     real allocator, which it may itself need
+ */
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    if (size > BOOT_BYTES - boot_used)
+	return NULL;
+    size = (size + 15) & ~(size_t)15;
+    if (boot_used + size > BOOT_BYTES)
+	return NULL;
+    p = boot_heap + boot_used;
+    boot_used += size;
+    return p;
+}
+
+static int is_boot(void *ptr)
+{
+    return (char *)ptr >= boot_heap && (char *)ptr < boot_heap + BOOT_BYTES;
+}
+
+/*************************************
+ * The interposed functions
+ ************************************/
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL) {
+	if (resolving)
+	    return boot_alloc(size);
+	recorder_init();
+    }
+    p = real_malloc(size);
+    record_alloc(p, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    size_t bytes;
+    void *p;
+
+    /* A wrapped product would record, and boot_alloc hand out, a block
+       too small; the real calloc fails instead */
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (real_calloc == NULL) {
+	if (resolving)
+	    return boot_alloc(bytes); /* static memory is zeroed */
+	recorder_init();
+    }
+    p = real_calloc(nmemb, size);
+    record_alloc(p, bytes);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || is_boot(ptr))
+	return;
+    if (real_free == NULL)
+	recorder_init();
+    record_release(ptr, BT_FREE, 0);
+    real_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    uint32_t id;
+    void *p;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (is_boot(ptr)) {
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr,
+		   size < (size_t)(boot_heap + BOOT_BYTES - (char *)ptr) ?
+		   size : (size_t)(boot_heap + BOOT_BYTES - (char *)ptr));
+	return p;
+    }
+    if (real_realloc == NULL)
+	recorder_init();
+    if (size == 0) {
+	record_release(ptr, BT_FREE, 0);
+	return real_realloc(ptr, size);
+    }
+
+    /* Take ptr out of the table before the real realloc can free it */
+    id = record_release(ptr, BT_REALLOC, size);
+    p = real_realloc(ptr, size);
+    if (id != NO_ID)
+	record_moved(p != NULL ? p : ptr, id);
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    int ret;
+
+    if (real_posix_memalign == NULL)
+	recorder_init();
+    if ((ret = real_posix_memalign(memptr, alignment, size)) == 0)
+	record_alloc(*memptr, size);
+    return ret;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (real_aligned_alloc == NULL)
+	recorder_init();
+    p = real_aligned_alloc(alignment, size);
+    record_alloc(p, size);
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (real_memalign == NULL)
+	recorder_init();
+    p = real_memalign(alignment, size);
+    record_alloc(p, size);
+    return p;
+}
@@ -0,0 +1,124 @@
+/*
+ * mmregion.c - Regions of objects that are all released at once
+ *
+ * See mmregion.h for the interface. Each chunk starts with a header
+ * of REGION_ALIGN bytes that links it to the chunk taken before it.
+ * Objects are carved from the current chunk until one does not fit;
+ * the rest of that chunk is then left unused and a new chunk, twice
+ * as large as the last up to REGION_MAX_CHUNK, becomes the current
+ * one. An object too large to leave room for others in a chunk gets
+ * a chunk of its own, and the current chunk stays current.
+ */
+#include <stdint.h>
+
+#include "mm.h"
+#include "mmregion.h"
+
+#define CHUNK_HEADER REGION_ALIGN  /* link to the previous chunk, padded */
+
+/*
+ * new_chunk - Takes a chunk with room for at least size bytes of
+ *     objects from mm_malloc and links it into region. Returns the
+ *     first byte after its header, or NULL if mm_malloc failed, and
+ *     sets *end to the end of the chunk's usable bytes. mm_usable_size
+ *     takes the arena lock, so it is asked only once per chunk.
+ */
+static char *new_chunk(mm_region_t *region, size_t size, char **end)
+{
+    char *chunk = mm_malloc(CHUNK_HEADER + size);
+    size_t usable;
+
+    if (chunk == NULL)
+	return NULL;
+    usable = mm_usable_size(chunk);
+    *(void **)chunk = region->chunks;
+    region->chunks = chunk;
+    region->num_chunks++;
+    region->bytes += usable;
+    *end = chunk + usable;
+    return chunk + CHUNK_HEADER;
+}
+
+/*
+ * alloc_slow - Serves a request of size bytes, already rounded up to
+ *     REGION_ALIGN, that the current chunk has no room for
+ */
+static void *alloc_slow(mm_region_t *region, size_t size)
+{
+    char *p, *end;
+
+    if (region->chunk_size == 0)
+	region->chunk_size = REGION_FIRST_CHUNK;
+
+    /* Bumping past a large object would waste the rest of the chunk */
+    if (size > region->chunk_size / 4)
+	return new_chunk(region, size, &end);
+
+    if ((p = new_chunk(region, region->chunk_size - CHUNK_HEADER, &end)) == NULL)
+	return NULL;
+    region->next = p + size;
+    region->end = end;
+    if (region->chunk_size < REGION_MAX_CHUNK)
+	region->chunk_size *= 2;
+    return p;
+}
+
+/*
+ * mm_region_init - Makes region empty. It holds no memory until the
+ *     first object is allocated.
+ */
+void mm_region_init(mm_region_t *region)
+{
+    region->chunks = NULL;
+    region->next = NULL;
+    region->end = NULL;
+    region->chunk_size = 0;
+    region->num_chunks = 0;
+    region->bytes = 0;
+}
+
+/*
+ * mm_region_alloc - Returns size bytes aligned to REGION_ALIGN that
+ *     live until the region is released, or NULL if out of memory.
+ *     A request of 0 bytes gets an object of its own, as in malloc.
+ */
+void *mm_region_alloc(mm_region_t *region, size_t size)
+{
+    char *p;
+
+    if (size > SIZE_MAX - 2 * REGION_ALIGN) /* no room to round up and add a header */
+	return NULL;
+    size = size == 0 ? REGION_ALIGN :
+	(size + REGION_ALIGN - 1) & ~(size_t)(REGION_ALIGN - 1);
+
+    if ((size_t)(region->end - region->next) < size)
+	return alloc_slow(region, size);
+    p = region->next;
+    region->next += size;
+    return p;
+}
+
+/*
+ * mm_region_release - Frees every object of region at once by giving
+ *     its chunks back to mm_free_batch, REGION_BATCH at a time, so
+ *     chunks that lie next to each other in the heap coalesce in one
+ *     step. The region is left empty and can be used again.
+ */
+void mm_region_release(mm_region_t *region)
+{
+    void *batch[REGION_BATCH];
+    void *chunk, *next;
+    size_t n = 0;
+
+    for (chunk = region->chunks; chunk != NULL; chunk = next) {
+	next = *(void **)chunk;      /* read before chunk may be freed */
+	batch[n++] = chunk;
+	if (n == REGION_BATCH) {
+	    mm_free_batch(batch, n);
+	    n = 0;
+	}
+    }
+    if (n > 0)
+	mm_free_batch(batch, n);
+    mm_region_init(region);
+}
@@ -0,0 +1,37 @@
+/*
+ * mmregion.h - Regions of objects that are all released at once
+ *
+ * A region hands out objects by bumping a pointer through chunks it
+ * takes from mm_malloc. Objects are never freed on their own:
+ * mm_region_release gives every chunk back in one mm_free_batch call
+ * per REGION_BATCH chunks, and the region can then be used again.
+ * This suits objects that die together, such as everything allocated
+ * while serving one request.
+ *
+ * A region is not locked, so it must be used by one thread at a time.
+ */
+#ifndef __MMREGION_H_
+#define __MMREGION_H_
+
+#include <stddef.h>
+
+#define REGION_ALIGN       16          /* alignment of every object */
+#define REGION_FIRST_CHUNK 4096        /* bytes of the first chunk... */
+#define REGION_MAX_CHUNK   (256*1024)  /* ... doubling up to this */
+#define REGION_BATCH       64          /* chunks per mm_free_batch call */
+
+/* A region; zero it or call mm_region_init before first use */
+typedef struct {
+    void *chunks;       /* chunks held, linked through their first word */
+    char *next;         /* next free byte of the current chunk... */
+    char *end;          /* ... and the end of that chunk */
+    size_t chunk_size;  /* bytes to ask for the next chunk, 0 for the first */
+    size_t num_chunks;  /* chunks held */
+    size_t bytes;       /* bytes held in them */
+} mm_region_t;
+
+void mm_region_init(mm_region_t *region);
+void *mm_region_alloc(mm_region_t *region, size_t size);
+void mm_region_release(mm_region_t *region);
+
+#endif /* __MMREGION_H_ */
@@ -0,0 +1,84 @@
+/*
+ * rep2bin.c - Convert a .rep trace file to the binary trace format
+ *
+ * Usage: rep2bin <in.rep> <out.bin>
+ *
+ * The requests are streamed from one file to the other, so traces of
+ * any length convert in constant memory. The converter checks the same
+ * things mdriver asserts when it reads a .rep file: that the header's
+ * request count is right and that the ids run from 0 to num_ids - 1.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bintrace.h"
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    char type[2];
+    int sugg_heapsize, num_ids, num_ops, weight;
+    unsigned index, size;
+    unsigned max_index = 0;
+    int op_index = 0;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: %s <in.rep> <out.bin>\n", argv[0]);
+	exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL) {
+	perror(argv[1]);
+	exit(1);
+    }
+    if (fscanf(in, "%d %d %d %d", &sugg_heapsize, &num_ids, &num_ops, 
+	       &weight) != 4 || num_ids < 0 || num_ops < 0) {
+	fprintf(stderr, "%s: bad trace header\n", argv[1]);
+	exit(1);
+    }
+    if ((out = fopen(argv[2], "w")) == NULL) {
+	perror(argv[2]);
+	exit(1);
+    }
+    bt_put_header(out, sugg_heapsize, num_ids, num_ops, weight);
+
+    /* Copy every request line, checking each as mdriver would */
+    while (fscanf(in, "%1s", type) == 1) {
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    if (fscanf(in, "%u %u", &index, &size) != 2)
+		goto bad;
+	    bt_put_op(out, type[0] == 'a' ? BT_ALLOC : BT_REALLOC, 
+		      index, size);
+	    break;
+	case 'f':
+	    if (fscanf(in, "%u", &index) != 1)
+		goto bad;
+	    bt_put_op(out, BT_FREE, index, 0);
+	    break;
+	default:
+	    goto bad;
+	}
+	max_index = (index > max_index) ? index : max_index;
+	op_index++;
+    }
+
+    if (op_index != num_ops || (num_ops > 0 && max_index != num_ids - 1)) {
+	fprintf(stderr, "%s: header says %d ids and %d requests, found %u "
+		"and %d\n", argv[1], num_ids, num_ops, max_index + 1, op_index);
+	remove(argv[2]);
+	exit(1);
+    }
+    fclose(in);
+    if (fclose(out) != 0) {
+	perror(argv[2]);
+	exit(1);
+    }
+    exit(0);
+
+ bad:
+    fprintf(stderr, "%s: bad request %d (%c)\n", argv[1], op_index + 1, 
+	    type[0]);
+    remove(argv[2]);
+    exit(1);
+}